@@ -0,0 +1,78 @@
+#include "Batch.hpp"
+#include "Diagnostics.hpp"
+#include "Options.hpp"
+
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+std::string getBatchOutputFilename(StringRef Input) {
+    SmallString<128> Output(Input);
+    sys::path::replace_extension(Output, CompileOnly ? "o" : "out");
+    return std::string(Output);
+}
+
+/// checkBatchOptions - the options --batch cannot share between units
+static bool checkBatchOptions(ArrayRef<std::string> Inputs) {
+    const char *Conflict = !OutputFilename.empty() ? "-o"
+                         : RunProgram              ? "--run"
+                         : !RemarksFile.empty()    ? "--remarks-file"
+                         : nullptr;
+    if (Conflict) {
+        errs() << "error: " << Conflict << " cannot be used with --batch\n";
+        return false;
+    }
+    if (Inputs.empty()) {
+        errs() << "error: --batch needs input files\n";
+        return false;
+    }
+    return true;
+}
+
+int compileBatch(ArrayRef<std::string> Inputs, CompileFn Compile) {
+    if (!checkBatchOptions(Inputs))
+        return 1;
+
+    struct Unit {
+        std::string Output;
+        std::string Log;
+        int RC = 0;
+    };
+    std::vector<Unit> Units(Inputs.size());
+
+    ThreadPool Pool(heavyweight_hardware_concurrency(Jobs.getNumOccurrences() ? Jobs : 0));
+    for (size_t I = 0; I < Inputs.size(); ++I) {
+        Pool.async([&, I] {
+            Unit &U = Units[I];
+            U.Output = getBatchOutputFilename(Inputs[I]);
+            raw_string_ostream Log(U.Log);
+            setDiagnosticStream(&Log);
+            U.RC = Compile(Inputs[I], U.Output);
+            setDiagnosticStream(nullptr);
+            Log.flush();
+        });
+    }
+    Pool.wait();
+
+    // in input order, however the threads finished
+    unsigned Failed = 0;
+    for (size_t I = 0; I < Inputs.size(); ++I) {
+        const Unit &U = Units[I];
+        errs() << U.Log;
+        if (!U.Log.empty() && U.Log.back() != '\n')
+            errs() << "\n";
+        if (U.RC == 0) {
+            errs() << Inputs[I] << ": compiled to " << U.Output << "\n";
+        } else {
+            errs() << Inputs[I] << ": failed\n";
+            ++Failed;
+        }
+    }
+    errs() << "batch: " << Inputs.size() << " files, " << Failed << " failed\n";
+    return Failed ? 1 : 0;
+}
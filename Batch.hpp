@@ -0,0 +1,28 @@
+#ifndef PJPPROJECT_BATCH_HPP
+#define PJPPROJECT_BATCH_HPP
+
+#include <string>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+
+/*
+ * --batch compiles every input file as a unit of its own, several units at
+ * once on a thread pool of one process. Targets are initialized and
+ * options parsed once; the compiler state is thread_local, so each unit
+ * has its own. The messages of every unit are collected and printed in
+ * input order, each followed by the result of the unit.
+ */
+
+/// CompileFn - compile Input into Output, returns the exit code
+using CompileFn = llvm::function_ref<int(llvm::StringRef Input, llvm::StringRef Output)>;
+
+/// getBatchOutputFilename - Input with .o (-c) or .out instead of .mila
+std::string getBatchOutputFilename(llvm::StringRef Input);
+
+/// compileBatch - compile all Inputs with Compile, -j of them at once (all
+/// cores by default), 1 if any of them failed
+int compileBatch(llvm::ArrayRef<std::string> Inputs, CompileFn Compile);
+
+#endif //PJPPROJECT_BATCH_HPP
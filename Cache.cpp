@@ -0,0 +1,203 @@
+#include "Cache.hpp"
+#include "Link.hpp"
+#include "Options.hpp"
+#include "Remarks.hpp"
+#include "Diagnostics.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+static CachePruningPolicy Policy;
+
+// pruneCache only ever deletes files with this prefix
+static const char EntryPrefix[] = "llvmcache-";
+
+// one byte is appended per hit or miss, concurrent compilers cannot lose
+// an update that way
+static const char HitsFile[] = "stats.hits";
+static const char MissesFile[] = "stats.misses";
+
+static SmallString<128> cachePath(const Twine &Name) {
+    SmallString<128> Path(CacheDir);
+    sys::path::append(Path, Name);
+    return Path;
+}
+
+static void warn(const Twine &Msg, std::error_code EC) {
+    diags() << "warning: cache: " << Msg << ": " << EC.message() << "\n";
+}
+
+bool initializeCache(std::string &Error) {
+    if (CacheDir.empty())
+        return true;
+    auto P = parseCachePruningPolicy(CachePolicy);
+    if (!P) {
+        Error = "invalid --cache-policy: " + toString(P.takeError());
+        return false;
+    }
+    Policy = *P;
+    return true;
+}
+
+bool cacheEnabled() {
+    return !CacheDir.empty() && !RunProgram && DumpIR.empty() && !DumpAST && !remarksEnabled();
+}
+
+/// describeCompiler - version and build of this compiler, every rebuild of
+/// mila invalidates the entries it did not produce
+static std::string describeCompiler() {
+    std::string Description = "mila|" LLVM_VERSION_STRING;
+    std::string Exe = sys::fs::getMainExecutable(nullptr, nullptr);
+    sys::fs::file_status Status;
+    if (!Exe.empty() && !sys::fs::status(Exe, Status))
+        Description += "|" + std::to_string(Status.getSize()) + "|" +
+                       std::to_string(sys::toTimeT(Status.getLastModificationTime()));
+    return Description;
+}
+
+std::string computeCacheKey(const SourceBuffer &Source, const TargetMachine &TM) {
+    // an executable also contains the runtime, --incremental links it from
+    // separately optimized functions
+    const UnitOptions &Opts = getUnitOptions();
+    std::string Kind = Opts.EmitLLVM      ? "ir"
+                     : Opts.CompileOnly   ? "object"
+                                          : "executable|" + describeLinker();
+    if (Incremental)
+        Kind += "|incremental";
+    // the partitions of -j do not link into the same bytes
+    Kind += "|j" + std::to_string(getCodegenJobs());
+    return computeCacheKey(Kind, StringRef(Source.begin(), Source.size()), TM);
+}
+
+std::string computeCacheKey(StringRef Kind, StringRef Content, const TargetMachine &TM) {
+    SHA1 Hasher;
+    auto Add = [&](StringRef Field) {
+        Hasher.update(Field);
+        Hasher.update(StringRef("\0", 1));
+    };
+
+    Add(describeCompiler());
+    Add(TM.getTargetTriple().str());
+    Add(TM.getTargetCPU());
+    Add(TM.getTargetFeatureString());
+    Add(MTune == "native" ? sys::getHostCPUName() : StringRef(MTune));
+    Add(std::to_string(OptLevel));
+    Add(BoundsCheck ? "bounds-check" : "");
+    Add(WholeProgram ? "whole-program" : "");
+    Add(Kind);
+    Hasher.update(Content);
+
+    return toHex(Hasher.final(), /*LowerCase=*/true);
+}
+
+/// getCacheEntry - path of the entry of Key, empty on a miss
+static std::string getCacheEntry(StringRef Key) {
+    SmallString<128> Entry = cachePath(EntryPrefix + Key);
+    int FD;
+    if (sys::fs::openFileForRead(Entry, FD))
+        return "";
+
+    // entries are pruned by access time, a hit makes this one the newest
+    sys::fs::setLastAccessAndModificationTime(FD, std::chrono::system_clock::now());
+    sys::Process::SafelyCloseFileDescriptor(FD);
+    return std::string(Entry);
+}
+
+bool fetchFromCache(StringRef Key, StringRef Output) {
+    std::string Entry = getCacheEntry(Key);
+    if (Entry.empty())
+        return false;
+
+    sys::fs::file_status Status;
+    std::error_code EC = sys::fs::status(Entry, Status);
+    if (!EC)
+        EC = sys::fs::copy_file(Entry, Output);
+    if (!EC)
+        EC = sys::fs::setPermissions(Output, Status.permissions());
+    if (EC) {
+        warn("cannot copy " + Entry + " to " + Output, EC);
+        return false;
+    }
+    return true;
+}
+
+std::string storeInCache(StringRef Key, StringRef Output) {
+    if (auto EC = sys::fs::create_directories(CacheDir)) {
+        warn("cannot create " + CacheDir, EC);
+        return "";
+    }
+
+    // written under a temporary name, then renamed at once, so nobody can
+    // read half an entry
+    SmallString<128> Temp;
+    int FD;
+    if (auto EC = sys::fs::createUniqueFile(cachePath("tmp-%%%%%%%%"), FD, Temp)) {
+        warn("cannot create an entry", EC);
+        return "";
+    }
+    std::error_code EC = sys::fs::copy_file(Output, FD);
+    sys::Process::SafelyCloseFileDescriptor(FD);
+
+    sys::fs::file_status Status;
+    if (!EC)
+        EC = sys::fs::status(Output, Status);
+    if (!EC)
+        EC = sys::fs::setPermissions(Temp, Status.permissions());
+    SmallString<128> Entry = cachePath(EntryPrefix + Key);
+    if (!EC)
+        EC = sys::fs::rename(Temp, Entry);
+    if (EC) {
+        warn("cannot store " + Output, EC);
+        sys::fs::remove(Temp);
+        return "";
+    }
+
+    pruneCache(CacheDir, Policy);
+    return std::string(Entry);
+}
+
+/// countEvents - number of hits or misses recorded in File
+static uint64_t countEvents(const char *File) {
+    uint64_t Size;
+    if (sys::fs::file_size(cachePath(File), Size))
+        return 0;
+    return Size;
+}
+
+void reportCacheResult(bool Hit) {
+    if (!sys::fs::create_directories(CacheDir)) {
+        std::error_code EC;
+        raw_fd_ostream Stats(cachePath(Hit ? HitsFile : MissesFile), EC, sys::fs::OF_Append);
+        if (!EC)
+            Stats << (Hit ? 'h' : 'm');
+    }
+
+    if (!CacheStats)
+        return;
+
+    uint64_t Entries = 0, Bytes = 0;
+    std::error_code EC;
+    for (sys::fs::directory_iterator I(CacheDir, EC), E; I != E && !EC; I.increment(EC)) {
+        if (!sys::path::filename(I->path()).startswith(EntryPrefix))
+            continue;
+        uint64_t Size;
+        if (!sys::fs::file_size(I->path(), Size)) {
+            ++Entries;
+            Bytes += Size;
+        }
+    }
+
+    diags() << "cache " << (Hit ? "hit" : "miss") << ": " << countEvents(HitsFile) << " hits, "
+            << countEvents(MissesFile) << " misses, " << Entries << " entries, " << Bytes
+            << " bytes in " << CacheDir << "\n";
+}
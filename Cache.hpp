@@ -0,0 +1,45 @@
+#ifndef PJPPROJECT_CACHE_HPP
+#define PJPPROJECT_CACHE_HPP
+
+#include <string>
+
+#include "SourceBuffer.hpp"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Target/TargetMachine.h"
+
+/*
+ * Cache of finished compilations in --cache-dir. An entry is the object
+ * file (-c) or the executable, named after a hash of everything its bytes
+ * depend on: the source, the compiler, the target, the options and, for
+ * executables, the runtime. A hit copies the entry to the output and skips
+ * the compilation; --cache-policy prunes the least recently used entries.
+ */
+
+/// initializeCache - check --cache-policy, false with Error set if invalid
+bool initializeCache(std::string &Error);
+
+/// cacheEnabled - --cache-dir is set and nothing asks for the compilation
+/// itself (--run, dumps, remarks)
+bool cacheEnabled();
+
+/// computeCacheKey - hash of Source and of what else decides the output
+std::string computeCacheKey(const SourceBuffer &Source, const llvm::TargetMachine &TM);
+
+/// computeCacheKey - hash of Content, a Kind of entry, together with the
+/// compiler, the target and the options that change generated code
+std::string computeCacheKey(llvm::StringRef Kind, llvm::StringRef Content,
+                            const llvm::TargetMachine &TM);
+
+/// fetchFromCache - copy the entry of Key to Output, false on a miss
+bool fetchFromCache(llvm::StringRef Key, llvm::StringRef Output);
+
+/// storeInCache - keep a copy of Output as the entry of Key and prune the
+/// cache, returns the path of the entry (empty if it could not be stored)
+std::string storeInCache(llvm::StringRef Key, llvm::StringRef Output);
+
+/// reportCacheResult - count a hit or a miss, print the totals with
+/// --cache-stats
+void reportCacheResult(bool Hit);
+
+#endif //PJPPROJECT_CACHE_HPP
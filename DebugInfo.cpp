@@ -0,0 +1,63 @@
+#include "DebugInfo.hpp"
+#include "ExprAst.hpp"
+#include "Options.hpp"
+
+#include <memory>
+
+#include "llvm/IR/DIBuilder.h"
+#include "llvm/Support/FileSystem.h"
+
+using namespace llvm;
+
+// null while no line tables are wanted
+static thread_local std::unique_ptr<DIBuilder> DBuilder;
+static thread_local DIFile *TheFile;
+
+void initializeDebugInfo(StringRef Filename) {
+  TheModule->addModuleFlag(Module::Warning, "Debug Info Version",
+                           DEBUG_METADATA_VERSION);
+  TheModule->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+
+  DBuilder = std::make_unique<DIBuilder>(*TheModule);
+  SmallString<128> Directory;
+  sys::fs::current_path(Directory);
+  TheFile = DBuilder->createFile(Filename == "-" ? "<stdin>" : Filename, Directory);
+  DBuilder->createCompileUnit(dwarf::DW_LANG_Pascal83, TheFile, "mila",
+                              OptLevel > 0, "", 0, StringRef(),
+                              DICompileUnit::LineTablesOnly);
+}
+
+void beginFunctionDebugInfo(Function &F, SourceLoc Loc) {
+  if (!DBuilder)
+    return;
+
+  // main is generated one statement at a time, its subprogram comes first
+  if (!F.getSubprogram()) {
+    DISubroutineType *Ty =
+        DBuilder->createSubroutineType(DBuilder->getOrCreateTypeArray(None));
+    DISubprogram *SP = DBuilder->createFunction(
+        TheFile, F.getName(), StringRef(), TheFile, Loc.Line, Ty, Loc.Line,
+        DINode::FlagPrototyped, DISubprogram::SPFlagDefinition);
+    F.setSubprogram(SP);
+  }
+  Builder->SetCurrentDebugLocation(
+      DILocation::get(*TheContext, Loc.Line, Loc.Col, F.getSubprogram()));
+}
+
+void endFunctionDebugInfo(Function &F) {
+  if (DBuilder && F.getSubprogram())
+    DBuilder->finalizeSubprogram(F.getSubprogram());
+}
+
+void emitLocation(SourceLoc Loc) {
+  if (!DBuilder || !Builder->GetInsertBlock())
+    return;
+  DISubprogram *SP = Builder->GetInsertBlock()->getParent()->getSubprogram();
+  if (SP)
+    Builder->SetCurrentDebugLocation(DILocation::get(*TheContext, Loc.Line, Loc.Col, SP));
+}
+
+void finalizeDebugInfo() {
+  if (DBuilder)
+    DBuilder->finalize();
+}
@@ -0,0 +1,32 @@
+#ifndef PJPPROJECT_DEBUGINFO_HPP
+#define PJPPROJECT_DEBUGINFO_HPP
+
+#include "Lexer.hpp"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+
+/*
+ * Line tables for the module being generated. They are only emitted when
+ * something reads them (optimization remarks), every statement then gets
+ * the debug location of its first token.
+ */
+
+/// initializeDebugInfo - start line tables of Filename in TheModule
+void initializeDebugInfo(llvm::StringRef Filename);
+
+/// beginFunctionDebugInfo - give F a subprogram starting at Loc (once) and
+/// move the builder's location into it
+void beginFunctionDebugInfo(llvm::Function &F, SourceLoc Loc);
+
+/// endFunctionDebugInfo - complete the subprogram of a finished function,
+/// before it is verified
+void endFunctionDebugInfo(llvm::Function &F);
+
+/// emitLocation - attribute the next instructions to Loc
+void emitLocation(SourceLoc Loc);
+
+/// finalizeDebugInfo - complete the debug metadata, before verification
+void finalizeDebugInfo();
+
+#endif //PJPPROJECT_DEBUGINFO_HPP
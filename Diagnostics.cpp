@@ -0,0 +1,13 @@
+#include "Diagnostics.hpp"
+
+using namespace llvm;
+
+static thread_local raw_ostream *DiagnosticStream = nullptr;
+
+raw_ostream &diags() {
+    return DiagnosticStream ? *DiagnosticStream : errs();
+}
+
+void setDiagnosticStream(raw_ostream *OS) {
+    DiagnosticStream = OS;
+}
@@ -0,0 +1,18 @@
+#ifndef PJPPROJECT_DIAGNOSTICS_HPP
+#define PJPPROJECT_DIAGNOSTICS_HPP
+
+#include "llvm/Support/raw_ostream.h"
+
+/*
+ * Messages of a compilation: errors, dumps, cache statistics. They go to
+ * stderr; --batch collects them per unit and prints them in input order.
+ */
+
+/// diags - stream for the messages of the compilation on this thread
+llvm::raw_ostream &diags();
+
+/// setDiagnosticStream - send the messages of this thread to OS, stderr
+/// again if null
+void setDiagnosticStream(llvm::raw_ostream *OS);
+
+#endif //PJPPROJECT_DIAGNOSTICS_HPP
@@ -1,5 +1,14 @@
 #include "ExprAst.hpp"
+#include "Optimizer.hpp"
+#include "Target.hpp"
 #include "Parser.hpp"
+#include "Options.hpp"
+#include "DebugInfo.hpp"
+#include "Remarks.hpp"
+#include "Diagnostics.hpp"
+
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/MDBuilder.h"
 
 
 
@@ -7,25 +16,51 @@
 // Code Generation
 //===----------------------------------------------------------------------===//
 
-std::unique_ptr<LLVMContext> TheContext;
+thread_local std::unique_ptr<LLVMContext> TheContext;
 
 // insert instructions and create new ones
-std::unique_ptr<IRBuilder<>> Builder;
+thread_local std::unique_ptr<IRBuilder<>> Builder;
 
 // TheModule is an LLVM construct that contains functions and global variables.
-std::unique_ptr<Module> TheModule;
+thread_local std::unique_ptr<Module> TheModule;
 
 // defined values in the current scope -> LLVM representation
-std::map<std::string, AllocaInst *> NamedValues;
+thread_local DenseMap<Symbol, AllocaInst *> NamedValues;
+
+// program level variables and constants -> their LLVM globals
+thread_local DenseMap<Symbol, GlobalVariable *> GlobalValues;
 
-std::unique_ptr<legacy::FunctionPassManager> TheFPM;
+// functions already emitted into TheModule
+thread_local DenseMap<Symbol, Function *> FunctionValues;
 
 // static std::unique_ptr<KaleidoscopeJIT> TheJIT;
-std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+thread_local DenseMap<Symbol, PrototypeAST *> FunctionProtos;
+
+thread_local ASTArena AST;
 
 ExitOnError ExitOnErr;
 
-std::set<std::string> constantVals;
+thread_local DenseMap<Symbol, int> ConstantValues;
+
+thread_local DenseMap<Value *, int> ArrayLowerBounds;
+
+// block the exits of the function being generated branch to, null in main
+static thread_local BasicBlock *ReturnBB;
+
+// start of the body, a recursive tail call stores its arguments into the
+// parameters and branches back here
+static thread_local BasicBlock *TailRecurseBB;
+static thread_local SmallVector<AllocaInst *, 4> ParamAllocas;
+
+// element accesses whose index range was checked once in front of their loop
+static thread_local DenseSet<const ExprAST *> InBoundsAccesses;
+
+// set while the copies of a versioned for loop are generated, loops nested
+// in them keep their per-access checks instead of doubling again
+static thread_local bool InVersionedLoop = false;
+
+// arrays start on a 32 byte boundary, so 256-bit vector loads stay aligned
+static const unsigned ArrayAlignment = 32;
 
 
 Value *LogErrorV(const char *Str) {
@@ -33,10 +68,30 @@ Value *LogErrorV(const char *Str) {
   return nullptr;
 }
 
-Function *getFunction(std::string Name) {
+void resetCodegenState() {
+  NamedValues.clear();
+  GlobalValues.clear();
+  FunctionValues.clear();
+  FunctionProtos.clear();
+  ConstantValues.clear();
+  ArrayLowerBounds.clear();
+  InBoundsAccesses.clear();
+  InVersionedLoop = false;
+  ParamAllocas.clear();
+  AST.reset();
+  Symbols.clear();
+
+  // a module must go before the context it lives in
+  Builder.reset();
+  TheModule.reset();
+  TheContext.reset();
+}
+
+Function *getFunction(Symbol Name) {
   // First, see if the function has already been added to the current module.
-  if (auto *F = TheModule->getFunction(Name))
-    return F;
+  auto FV = FunctionValues.find(Name);
+  if (FV != FunctionValues.end())
+    return FV->second;
 
   // If not, check whether we can codegen the declaration from some existing
   // prototype.
@@ -48,18 +103,101 @@ Function *getFunction(std::string Name) {
   return nullptr;
 }
 
+/// lookupVariable - Storage of a variable: the local alloca if the name is
+/// bound in the current function, otherwise the program level global.
+Value *lookupVariable(Symbol Name) {
+  auto NV = NamedValues.find(Name);
+  if (NV != NamedValues.end() && NV->second)
+    return NV->second;
+  auto GV = GlobalValues.find(Name);
+  if (GV != GlobalValues.end())
+    return GV->second;
+  return nullptr;
+}
+
 /// CreateEntryBlockAlloca - Create an alloca instruction in the entry block of
-/// the function.  This is used for mutable variables etc.
-AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, 
-                                          StringRef VarName) {
+/// the function.  This is used for mutable variables etc., i32 unless Ty is
+/// given.
+AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, StringRef VarName,
+                                   Type *Ty) {
   IRBuilder<> TmpB(&TheFunction->getEntryBlock(),
                    TheFunction->getEntryBlock().begin());
-  return TmpB.CreateAlloca(Type::getInt32Ty(*TheContext), nullptr, VarName);
+  if (!Ty)
+    Ty = Type::getInt32Ty(*TheContext);
+  return TmpB.CreateAlloca(Ty, nullptr, VarName);
+}
+
+/// getArrayType - type of an array variable's storage, null for scalars
+ArrayType *getArrayType(Value *Storage) {
+  if (auto *AI = dyn_cast_or_null<AllocaInst>(Storage))
+    return dyn_cast<ArrayType>(AI->getAllocatedType());
+  if (auto *GV = dyn_cast_or_null<GlobalVariable>(Storage))
+    return dyn_cast<ArrayType>(GV->getValueType());
+  return nullptr;
 }
 
 bool ExprAST::createGlobal() { return true; }
 
-const std::string ExprAST::getName() const {return "ERROR_NOT_IMPLEMENTED"; }
+Symbol ExprAST::getName() const { return Sym_None; }
+
+Value *ExprAST::codegenAddress() {
+  return LogErrorV("destination of an assignment must be a variable");
+}
+
+void ExprAST::forEachChild(function_ref<void(ExprAST *)> Fn) {}
+
+bool ExprAST::mayWrite(Symbol Var) const { return false; }
+
+bool ExprAST::matchAffine(Symbol &Var, int64_t &Offset) const { return false; }
+
+ArrayExprAST *ExprAST::asArrayAccess() { return nullptr; }
+
+bool ExprAST::evaluate(int &Result) const { return false; }
+
+void ExprAST::markTailCalls(Symbol Result, bool InTail) {}
+
+bool ExprAST::isExit() const { return false; }
+
+ArrayRef<VarDecl> ExprAST::getDecls() const { return {}; }
+
+Symbol ExprAST::getCallee() const { return Sym_None; }
+
+/// markTailCallsIn - a statement list; its last statement is in tail position
+/// if the list is, a statement followed by exit always is
+static void markTailCallsIn(ArrayRef<ExprAST *> Stmts, Symbol Result, bool InTail) {
+  for (size_t i = 0; i < Stmts.size(); ++i) {
+    bool Last = i + 1 == Stmts.size();
+    Stmts[i]->markTailCalls(Result, Last ? InTail : Stmts[i + 1]->isExit());
+  }
+}
+
+/// emitTailCallRemark - report what became of a call for --remarks=tailcall
+static void emitTailCallRemark(bool Passed, StringRef Name, const Twine &Msg) {
+  if (!remarksEnabled())
+    return;
+  BasicBlock *BB = Builder->GetInsertBlock();
+  const DebugLoc &Loc = Builder->getCurrentDebugLocation();
+  if (Passed) {
+    OptimizationRemark R("tailcall", Name, Loc, BB);
+    R << Msg.str();
+    TheContext->diagnose(R);
+  } else {
+    OptimizationRemarkMissed R("tailcall", Name, Loc, BB);
+    R << Msg.str();
+    TheContext->diagnose(R);
+  }
+}
+
+/// isConstant - Name is a constant not hidden by a local variable
+static bool isConstant(Symbol Name) {
+  return !NamedValues.lookup(Name) && ConstantValues.count(Name);
+}
+
+/// walk - call Fn on E and on every node below it
+static void walk(ExprAST *E, function_ref<void(ExprAST *)> Fn) {
+  Fn(E);
+  E->forEachChild([&](ExprAST *Child) { walk(Child, Fn); });
+}
 
 
 Value *NumberExprAST::codegen() {
@@ -67,49 +205,151 @@ Value *NumberExprAST::codegen() {
     return ConstantInt::get(*TheContext, APInt(32, Val, true)); 
 }
 
+bool NumberExprAST::matchAffine(Symbol &Var, int64_t &Offset) const {
+  Var = Sym_None;
+  Offset = Val;
+  return true;
+}
+
+bool NumberExprAST::evaluate(int &Result) const {
+  Result = Val;
+  return true;
+}
+
 Value *VariableExprAST::codegen() {
+  // constants are immediates, nothing is loaded
+  if (isConstant(Name))
+    return Builder->getInt32(ConstantValues.lookup(Name));
+
     // Look this variable up in the function.
-  Value *V = NamedValues[Name];
-  if (!V){
-    V = TheModule->getNamedGlobal(Name);
-    if (!V)
-      return LogErrorV("Unknown variable name1");
-  }
+  Value *V = lookupVariable(Name);
+  if (!V)
+    return LogErrorV("Unknown variable name1");
+  if (getArrayType(V))
+    return LogErrorV("array used as a value");
 
   // Load the value.
-  return Builder->CreateLoad(V, Name.c_str());
+  return Builder->CreateLoad(Type::getInt32Ty(*TheContext), V, Symbols.str(Name));
+}
+
+Value *VariableExprAST::codegenAddress() {
+  if (isConstant(Name))
+    return LogErrorV("no constants");
+  Value *V = lookupVariable(Name);
+  if (!V)
+    return LogErrorV("Unknown variable name2");
+  return V;
+}
+
+Symbol VariableExprAST::getName() const { return Name; }
+
+bool VariableExprAST::matchAffine(Symbol &Var, int64_t &Offset) const {
+  if (isConstant(Name)) {
+    Var = Sym_None;
+    Offset = ConstantValues.lookup(Name);
+  } else {
+    Var = Name;
+    Offset = 0;
+  }
+  return true;
+}
+
+bool VariableExprAST::evaluate(int &Result) const {
+  auto C = ConstantValues.find(Name);
+  if (C == ConstantValues.end())
+    return false;
+  Result = C->second;
+  return true;
+}
+
+/// getBoundsErrorFunction - runtime routine reporting an index out of bounds
+static FunctionCallee getBoundsErrorFunction() {
+  Type *Int32 = Builder->getInt32Ty();
+  FunctionCallee F = TheModule->getOrInsertFunction(
+      "milaBoundsError",
+      FunctionType::get(Builder->getVoidTy(), {Int32, Int32, Int32}, false));
+  if (auto *Fn = dyn_cast<Function>(F.getCallee())) {
+    Fn->setDoesNotReturn();
+    Fn->setDoesNotThrow();
+    Fn->addFnAttr(Attribute::Cold);
+  }
+  return F;
+}
+
+/// emitBoundsCheck - continue only if Idx is in [Lo .. Lo + N - 1], the
+/// failing branch reports the index and exits
+static void emitBoundsCheck(Value *Idx, int Lo, uint64_t N) {
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  int Hi = (int) (Lo + (int64_t) N - 1);
+
+  // one unsigned compare covers both bounds
+  Value *Rel = Builder->CreateSub(Idx, Builder->getInt32(Lo), "relidx");
+  Value *InBounds = Builder->CreateICmpULT(Rel, Builder->getInt32(N), "inbounds");
+
+  BasicBlock *FailBB = BasicBlock::Create(*TheContext, "boundserror", TheFunction);
+  BasicBlock *OkBB = BasicBlock::Create(*TheContext, "inbounds", TheFunction);
+  MDBuilder MDB(*TheContext);
+  Builder->CreateCondBr(InBounds, OkBB, FailBB, MDB.createBranchWeights(2000, 1));
+
+  Builder->SetInsertPoint(FailBB);
+  Builder->CreateCall(getBoundsErrorFunction(),
+                      {Idx, Builder->getInt32(Lo), Builder->getInt32(Hi)});
+  Builder->CreateUnreachable();
+
+  Builder->SetInsertPoint(OkBB);
+}
+
+Value *ArrayExprAST::codegenAddress() {
+  Value *Array = lookupVariable(Name);
+  if (!Array)
+    return LogErrorV("Unknown variable name");
+  ArrayType *AT = getArrayType(Array);
+  if (!AT)
+    return LogErrorV("indexed variable is not an array");
+
+  Value *Idx = Index->codegen();
+  if (!Idx)
+    return nullptr;
+
+  int Lo = ArrayLowerBounds.lookup(Array);
+  if (BoundsCheck && !InBoundsAccesses.count(this))
+    emitBoundsCheck(Idx, Lo, AT->getNumElements());
+
+  // the lower bound is folded into the element offset, X[Lo] is element 0
+  Value *Offset = Builder->CreateNSWSub(
+      Builder->CreateSExt(Idx, Builder->getInt64Ty(), "idxext"),
+      Builder->getInt64(Lo), "elemidx");
+  return Builder->CreateInBoundsGEP(AT, Array, {Builder->getInt64(0), Offset},
+                                    "elemptr");
 }
-const std::string VariableExprAST::getName() const { return Name; }
+
+Value *ArrayExprAST::codegen() {
+  Value *Ptr = codegenAddress();
+  if (!Ptr)
+    return nullptr;
+  return Builder->CreateLoad(Type::getInt32Ty(*TheContext), Ptr, Symbols.str(Name));
+}
+
+void ArrayExprAST::forEachChild(function_ref<void(ExprAST *)> Fn) { Fn(Index); }
+
+ArrayExprAST *ArrayExprAST::asArrayAccess() { return this; }
 
 Value *BinaryExprAST::codegen() {
-  // Special case '=' because we don't want to emit the LHS as an expression.
-  if (Op == '=') {
-    // Assignment requires the LHS to be an identifier.
-    // This assume we're building without RTTI because LLVM builds that way by
-    // default.  If you build LLVM with RTTI this can be changed to a
-    // dynamic_cast for automatic error checking.
-    VariableExprAST *LHSE = static_cast<VariableExprAST *>(LHS.get());
-    if (!LHSE)
-      return LogErrorV("destination of '=' must be a variable");
+  // Special case assignment because we don't want to emit the LHS as an
+  // expression, a variable or an array element gives the address to store to.
+  if (Op == '=' || Op == (char) tok_assign) {
     // Codegen the RHS.
     Value *Val = RHS->codegen();
     if (!Val)
       return nullptr;
 
-    // Look up the name.
-    if (constantVals.find(LHSE->getName()) != constantVals.end()) {
-      return LogErrorV("no constants");
-    }
-    Value *Var = NamedValues[LHSE->getName()];
-    if (!Var){
-      // check global
-      Var = TheModule->getNamedGlobal(LHSE->getName());
-      if (!Var)
-        return LogErrorV("Unknown variable name2");
-    }
+    Value *Var = LHS->codegenAddress();
+    if (!Var)
+      return nullptr;
+    if (getArrayType(Var))
+      return LogErrorV("cannot assign to a whole array");
 
     Builder->CreateStore(Val, Var);
-    TheModule->print(errs(), nullptr);
 
     return Val;
   }
@@ -128,7 +368,16 @@ Value *BinaryExprAST::codegen() {
     case '*':
         return Builder->CreateMul(L, R, "multmp");
     case '/':
+    case tok_div:
         return Builder->CreateSDiv(L, R, "divtmp");
+    case tok_mod:
+        return Builder->CreateSRem(L, R, "modtmp");
+    case tok_and:
+        return Builder->CreateAnd(L, R, "andtmp");
+    case tok_or:
+        return Builder->CreateOr(L, R, "ortmp");
+    case tok_xor:
+        return Builder->CreateXor(L, R, "xortmp");
     case '<':
         L = Builder->CreateICmpSLT(L, R, "lecmptmp");
         return Builder->CreateIntCast(L, Type::getInt32Ty(*TheContext), true, "booltmp");
@@ -153,13 +402,77 @@ Value *BinaryExprAST::codegen() {
 
   // If it wasn't a builtin binary operator, it must be a user defined one. Emit
   // a call to it.
-  Function *F = getFunction(std::string("binary") + Op);
+  Function *F = getFunction(Symbols.intern(std::string("binary") + Op));
   assert(F && "binary operator not found!");
 
   Value *Ops[2] = { L, R };
   return Builder->CreateCall(F, Ops, "binop");
 }
 
+void BinaryExprAST::forEachChild(function_ref<void(ExprAST *)> Fn) {
+  Fn(LHS);
+  Fn(RHS);
+}
+
+bool BinaryExprAST::mayWrite(Symbol Var) const {
+  return (Op == '=' || Op == (char) tok_assign) && LHS->getName() == Var;
+}
+
+void BinaryExprAST::markTailCalls(Symbol Result, bool InTail) {
+  // Name := call(...) followed by the return
+  if (InTail && Result != Sym_None && mayWrite(Result))
+    RHS->markTailCalls(Sym_None, true);
+}
+
+bool BinaryExprAST::evaluate(int &Result) const {
+  int L, R;
+  if (!LHS->evaluate(L) || !RHS->evaluate(R))
+    return false;
+
+  // the same 32-bit wrapping arithmetic as the generated code
+  uint32_t UL = L, UR = R;
+  switch (Op) {
+    case '+':                     Result = (int) (UL + UR); return true;
+    case '-':                     Result = (int) (UL - UR); return true;
+    case '*':                     Result = (int) (UL * UR); return true;
+    case '/':
+    case (char) tok_div:
+    case (char) tok_mod:
+      // left for run time, like the division it would trap on
+      if (R == 0 || (L == INT32_MIN && R == -1))
+        return false;
+      Result = Op == (char) tok_mod ? L % R : L / R;
+      return true;
+    case (char) tok_and:          Result = L & R; return true;
+    case (char) tok_or:           Result = L | R; return true;
+    case (char) tok_xor:          Result = L ^ R; return true;
+    // comparisons give 0 / -1
+    case '<':                     Result = -(L < R); return true;
+    case (char) tok_lessequal:    Result = -(L <= R); return true;
+    case '>':                     Result = -(L > R); return true;
+    case (char) tok_greaterequal: Result = -(L >= R); return true;
+    case (char) tok_eq:           Result = -(L == R); return true;
+    case (char) tok_notequal:     Result = -(L != R); return true;
+  }
+  return false;
+}
+
+bool BinaryExprAST::matchAffine(Symbol &Var, int64_t &Offset) const {
+  if (Op != '+' && Op != '-')
+    return false;
+  Symbol LVar, RVar;
+  int64_t LOffset, ROffset;
+  if (!LHS->matchAffine(LVar, LOffset) || !RHS->matchAffine(RVar, ROffset))
+    return false;
+  // at most one variable, and it must not be subtracted
+  if (RVar != Sym_None && (Op == '-' || LVar != Sym_None))
+    return false;
+
+  Var = LVar != Sym_None ? LVar : RVar;
+  Offset = Op == '+' ? LOffset + ROffset : LOffset - ROffset;
+  return Offset >= INT32_MIN && Offset <= INT32_MAX;
+}
+
 // create writeln function
 void writelnFunction(){
   // std::vector<Type*> Ints(1, Type::getInt32Ty(MilaContext));
@@ -168,6 +481,7 @@ void writelnFunction(){
   Function * F = Function::Create(FT, Function::ExternalLinkage, "writeln", TheModule.get());
   for (auto & Arg : F->args())
       Arg.setName("x");
+  FunctionValues[Sym_writeln] = F;
 }
 
 void readlnFunction() {
@@ -177,6 +491,16 @@ void readlnFunction() {
     // Set names for all arguments.
     for (auto & Arg : F->args())
         Arg.setName("x");
+    FunctionValues[Sym_readln] = F;
+}
+
+/// getReadlnArrayFunction - runtime routine filling a whole array from input
+static FunctionCallee getReadlnArrayFunction() {
+  return TheModule->getOrInsertFunction(
+      "readlnArray",
+      FunctionType::get(Builder->getInt32Ty(),
+                        {Type::getInt32PtrTy(*TheContext), Builder->getInt32Ty()},
+                        false));
 }
 
 Value *CallExprAST::codegen() {
@@ -191,17 +515,20 @@ Value *CallExprAST::codegen() {
 
   std::vector<Value *> ArgsV;
   for (unsigned i = 0, e = Args.size(); i != e; ++i) {
-    if (CalleeF->getName() == "readln"){
-      Value * V = NamedValues[Args[i]->getName()];
-      if (!V){
-        V = TheModule->getNamedGlobal(Args[i]->getName());
-        if (!V)
-          return LogErrorV("Unknown variable name");
-    }
-    // load value and store it
-    Builder->CreateLoad(Builder->CreateIntToPtr(V, Type::getInt32PtrTy(*TheContext)), "ptr");
-    ArgsV.push_back(Builder->CreateIntToPtr(V, Type::getInt32PtrTy(*TheContext)));
-  
+    if (Callee == Sym_readln){
+      Value *Ptr = Args[i]->codegenAddress();
+      if (!Ptr)
+        return nullptr;
+
+      // readln of a whole array reads one number per element
+      if (ArrayType *AT = getArrayType(Ptr)) {
+        Value *First = Builder->CreateInBoundsGEP(
+            AT, Ptr, {Builder->getInt64(0), Builder->getInt64(0)}, "first");
+        return Builder->CreateCall(getReadlnArrayFunction(),
+                                   {First, Builder->getInt32(AT->getNumElements())},
+                                   "calltmp");
+      }
+      ArgsV.push_back(Ptr);
     } else  { // writeln
       ArgsV.push_back(Args[i]->codegen());
     }
@@ -210,10 +537,87 @@ Value *CallExprAST::codegen() {
       return nullptr;
   }
 
+  Function *Caller = Builder->GetInsertBlock()->getParent();
+  if (IsTail && ReturnBB)
+    return codegenTailCall(CalleeF, ArgsV);
+  if (CalleeF == Caller && ReturnBB)
+    emitTailCallRemark(false, "NotInTailPosition",
+                       "recursive call to '" + CalleeF->getName() + "' is not in tail position");
+
+  CallInst *Call;
   if (CalleeF->getReturnType()->isVoidTy())
-    return Builder->CreateCall(CalleeF, ArgsV);
+    Call = Builder->CreateCall(CalleeF, ArgsV);
+  else
+    Call = Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+  Call->setCallingConv(CalleeF->getCallingConv());
+  return Call;
+}
 
-  return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
+/// codegenTailCall - a call whose value is returned right away
+///
+///   recursive:           store the arguments into the parameters and
+///                        branch back to the start of the body
+///   same signature:      musttail call and return its value
+///   otherwise:           tail call, the return block returns the value
+///
+/// Mila passes arguments by value, so no callee can see the caller's frame.
+/// The code after the first two follows in an unreachable block.
+Value *CallExprAST::codegenTailCall(Function *CalleeF, ArrayRef<Value *> ArgsV) {
+  Function *Caller = Builder->GetInsertBlock()->getParent();
+  StringRef Name = CalleeF->getName();
+
+  if (CalleeF == Caller) {
+    // all arguments are evaluated before the first parameter changes
+    for (unsigned i = 0, e = ArgsV.size(); i != e; ++i)
+      Builder->CreateStore(ArgsV[i], ParamAllocas[i]);
+    Builder->CreateBr(TailRecurseBB);
+    emitTailCallRemark(true, "TailRecursionToLoop",
+                       "recursive tail call to '" + Name + "' turned into a loop");
+  } else if (CalleeF->getFunctionType() == Caller->getFunctionType() &&
+             CalleeF->getCallingConv() == Caller->getCallingConv()) {
+    CallInst *Call = Builder->CreateCall(CalleeF, ArgsV);
+    Call->setCallingConv(CalleeF->getCallingConv());
+    Call->setTailCallKind(CallInst::TCK_MustTail);
+    if (Call->getType()->isVoidTy())
+      Builder->CreateRetVoid();
+    else
+      Builder->CreateRet(Call);
+    emitTailCallRemark(true, "MustTail", "tail call to '" + Name + "' is guaranteed");
+  } else {
+    CallInst *Call = Builder->CreateCall(CalleeF, ArgsV);
+    Call->setCallingConv(CalleeF->getCallingConv());
+    Call->setTailCall();
+    emitTailCallRemark(false, "SignatureMismatch",
+                       "tail call to '" + Name + "' is not guaranteed, its signature differs from '" +
+                           Caller->getName() + "'");
+    return Call;
+  }
+
+  BasicBlock *DeadBB = BasicBlock::Create(*TheContext, "aftertail", Caller);
+  Builder->SetInsertPoint(DeadBB);
+  return Builder->getInt32(0);
+}
+
+void CallExprAST::forEachChild(function_ref<void(ExprAST *)> Fn) {
+  for (ExprAST *A : Args)
+    Fn(A);
+}
+
+Symbol CallExprAST::getCallee() const { return Callee; }
+
+void CallExprAST::markTailCalls(Symbol Result, bool InTail) {
+  // readln gets the address of a local, it cannot leave the frame
+  if (InTail && Result == Sym_None && Callee != Sym_readln)
+    IsTail = true;
+}
+
+bool CallExprAST::mayWrite(Symbol Var) const {
+  if (Callee != Sym_readln)
+    return false;
+  for (const ExprAST *A : Args)
+    if (A->getName() == Var)
+      return true;
+  return false;
 }
 
 bool PrototypeAST::isUnaryOp() const { return IsOperator && Args.size() == 1; }
@@ -221,10 +625,12 @@ bool PrototypeAST::isBinaryOp() const { return IsOperator && Args.size() == 2; }
 
 char PrototypeAST::getOperatorName() const {
     assert(isUnaryOp() || isBinaryOp());
-    return Name[Name.size() - 1];
+    return Symbols.str(Name).back();
 }
 
-const std::string & PrototypeAST::getName() const { return Name; } 
+Symbol PrototypeAST::getName() const { return Name; }
+
+ArrayRef<Symbol> PrototypeAST::getArgs() const { return Args; }
 
 unsigned PrototypeAST::getBinaryPrecedence() const { return Precedence; }
 
@@ -239,20 +645,26 @@ Function *PrototypeAST::codegen() {
     FunctionType::get(Type::getInt32Ty(*TheContext), Ints, false);
 
   Function *F =
-    Function::Create(FT, Function::ExternalLinkage, Name, TheModule.get());
+    Function::Create(FT, Function::ExternalLinkage, Symbols.str(Name), TheModule.get());
+  applyTargetAttributes(*F);
+  // only main is called from outside the program, the rest can use the
+  // cheaper convention (set before any call to F is emitted)
+  if (WholeProgram && Name != Sym_main)
+    F->setCallingConv(CallingConv::Fast);
+  FunctionValues[Name] = F;
 
     // Set names for all arguments.
     unsigned Idx = 0;
     for (auto &Arg : F->args())
-        Arg.setName(Args[Idx++]);
+        Arg.setName(Symbols.str(Args[Idx++]));
     return F;
 }
 
 Function *FunctionAST::codegen() {
-  // Transfer ownership of the prototype to the FunctionProtos map, but keep a
-  // reference to it for use below.
+  // Register the prototype in the FunctionProtos map (the arena owns it) and
+  // keep a reference to it for use below.
   auto &P = *Proto;
-  FunctionProtos[Proto->getName()] = std::move(Proto);
+  FunctionProtos[Proto->getName()] = Proto;
   Function *TheFunction = getFunction(P.getName());
   if (!TheFunction)
     return nullptr;
@@ -268,9 +680,11 @@ Function *FunctionAST::codegen() {
     Builder->SetInsertPoint(BB);
   }
   else Builder->SetInsertPoint(&*std::prev(TheFunction->end()));
+  beginFunctionDebugInfo(*TheFunction, P.Loc);
   
   // Record the function arguments in the NamedValues map.
   NamedValues.clear();
+  ParamAllocas.clear();
   for (auto &Arg : TheFunction->args()) {
     // Create an alloca for this variable.
     AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Arg.getName());
@@ -279,34 +693,112 @@ Function *FunctionAST::codegen() {
     Builder->CreateStore(&Arg, Alloca);
 
     // Add arguments to variable symbol table.
-    NamedValues[std::string(Arg.getName())] = Alloca;
+    NamedValues[P.getArgs()[Arg.getArgNo()]] = Alloca;
+    ParamAllocas.push_back(Alloca);
   }
 
-  for (int i = 0 ; i < Body.size(); i++){
-    if (Value *RetVal = Body[i]->codegen()) {
-      if (P.getName() != "main" && i == Body.size() - 1) {
+  // A function returns the value last assigned to its name, every exit
+  // branches to one return block. main returns directly.
+  bool IsMain = P.getName() == Sym_main;
+  AllocaInst *Result = nullptr;
+  ReturnBB = IsMain ? nullptr : BasicBlock::Create(*TheContext, "return");
+  if (!IsMain) {
+    // every recursive tail call starts over here, as a fresh call would
+    TailRecurseBB = BasicBlock::Create(*TheContext, "tailrecurse", TheFunction);
+    Builder->CreateBr(TailRecurseBB);
+    Builder->SetInsertPoint(TailRecurseBB);
+  }
+  if (!IsMain && !isProcedure) {
+    Result = CreateEntryBlockAlloca(TheFunction, Symbols.str(P.getName()));
+    Builder->CreateStore(Builder->getInt32(0), Result);
+    NamedValues[P.getName()] = Result;
+  }
 
-        // Finish off the function.
-        if (isProcedure)        Builder->CreateRet(nullptr);
-        else if (!isProcedure)  Builder->CreateRet(RetVal);
-      }
+  // functions that never assign their name return the value of their last
+  // statement, as before results were supported
+  bool AssignsResult = false;
+  for (ExprAST *E : Body)
+    walk(E, [&](ExprAST *Node) { AssignsResult |= Node->mayWrite(P.getName()); });
 
-      // Validate the generated code, checking for consistency.
-      verifyFunction(*TheFunction);
+  // those are left alone, otherwise calls right before the return become
+  // tail calls
+  if (!IsMain && (isProcedure || AssignsResult))
+    markTailCallsIn(Body, isProcedure ? Sym_None : P.getName(), true);
 
+  Value *LastVal = nullptr;
+  for (int i = 0 ; i < Body.size(); i++){
+    emitLocation(Body[i]->Loc);
+    if (Value *RetVal = Body[i]->codegen()) {
+      LastVal = RetVal;
     } else  {
       // Error reading body, remove function.
+      FunctionValues.erase(P.getName());
       TheFunction->eraseFromParent();
+      delete ReturnBB;
+      ReturnBB = nullptr;
+      TailRecurseBB = nullptr;
 
       if (P.isBinaryOp())
         BinopPrecedence.erase(P.getOperatorName());
       return nullptr;
     }
   }
+
+  // main only gets its return in main(), it is optimized together with the
+  // module
+  if (!IsMain) {
+    if (Result && !AssignsResult && LastVal && LastVal->getType()->isIntegerTy(32))
+      Builder->CreateStore(LastVal, Result);
+
+    Builder->CreateBr(ReturnBB);
+    TheFunction->getBasicBlockList().push_back(ReturnBB);
+    Builder->SetInsertPoint(ReturnBB);
+    ReturnBB = nullptr;
+    TailRecurseBB = nullptr;
+    if (Result)
+      Builder->CreateRet(Builder->CreateLoad(Type::getInt32Ty(*TheContext), Result, "result"));
+    else
+      Builder->CreateRetVoid();
+    endFunctionDebugInfo(*TheFunction);
+
+    // a defined function is only visible to the program, so the module
+    // pipeline may inline it everywhere, change its signature or delete it
+    if (WholeProgram)
+      TheFunction->setLinkage(GlobalValue::InternalLinkage);
+
+    // Validate the generated code, checking for consistency.
+    if (verifyFunction(*TheFunction, &diags())) {
+      FunctionValues.erase(P.getName());
+      TheFunction->eraseFromParent();
+      return nullptr;
+    }
+    optimizeFunction(*TheFunction);
+  }
   return TheFunction;
 }
 
+void FunctionAST::forEachNode(function_ref<void(ExprAST *)> Fn) const {
+  for (ExprAST *E : Body)
+    walk(E, Fn);
+}
+
+bool FunctionAST::references(Symbol Name) const {
+  if (Proto->getName() == Name || is_contained(Proto->getArgs(), Name))
+    return false;
+
+  bool Declared = false, Used = false;
+  forEachNode([&](ExprAST *Node) {
+    Declared |= any_of(Node->getDecls(), [&](const VarDecl &D) { return D.Name == Name; });
+    // for loops name their variable without a node of its own
+    Used |= Node->getName() == Name || Node->mayWrite(Name);
+    if (ArrayExprAST *A = Node->asArrayAccess())
+      Used |= A->getArrayName() == Name;
+  });
+  return Used && !Declared;
+}
+
 Value *IfExprAST::codegen() {
+  emitLocation(Cond->Loc);
   Value *CondV = Cond->codegen();
   if (!CondV)
     return nullptr;
@@ -320,20 +812,24 @@ Value *IfExprAST::codegen() {
 
   // Create blocks for the then and else cases.  Insert the 'then' block at the
   // end of the function.
+  BasicBlock *CondBB = Builder->GetInsertBlock();
   BasicBlock *ThenBB = BasicBlock::Create(*TheContext, "then", TheFunction);
-  BasicBlock *ElseBB;
+  BasicBlock *ElseBB = nullptr;
   if (isElse) ElseBB = BasicBlock::Create(*TheContext, "else");
   BasicBlock *MergeBB = BasicBlock::Create(*TheContext, "ifcont");
 
-  if (!isElse)  
+  // without an else branch a false condition falls through to the merge block
+  if (isElse)
+    Builder->CreateCondBr(CondV, ThenBB, ElseBB);
+  else
     Builder->CreateCondBr(CondV, ThenBB, MergeBB);
-  Builder->CreateCondBr(CondV, ThenBB, ElseBB);
 
   // Emit then value.
   Builder->SetInsertPoint(ThenBB);
 
-  Value *ThenV;
+  Value *ThenV = Builder->getInt32(0);
   for (const auto & th: Then) {
+    emitLocation(th->Loc);
     ThenV = th->codegen();
     if (!ThenV)
       return nullptr;
@@ -349,6 +845,7 @@ Value *IfExprAST::codegen() {
   }
   Value *ElseV;
   if (isElse){
+    emitLocation(Else->Loc);
     ElseV = Else->codegen();
     if (!ElseV)
       return nullptr;  
@@ -367,84 +864,206 @@ Value *IfExprAST::codegen() {
   PN->addIncoming(ThenV, ThenBB);
   if (isElse)
     PN->addIncoming(ElseV, ElseBB);
+  else
+    PN->addIncoming(Builder->getInt32(0), CondBB);
   return PN;
 }
-// TODO
-Value *ForExprAST::codegen() {
-    Function * TheFunction = Builder->GetInsertBlock()->getParent();
-
-    // Create an alloca for the variable in the entry block.
-    AllocaInst * Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
 
-    // Emit the start code first, without 'variable' in scope.
-    Value * StartVal = Start->codegen();
-    if (!StartVal)
-        return nullptr;
-
-    // Store the value into the alloca.
-    Builder->CreateStore(StartVal, Alloca);
+void IfExprAST::markTailCalls(Symbol Result, bool InTail) {
+  markTailCallsIn(Then, Result, InTail);
+  if (isElse)
+    Else->markTailCalls(Result, InTail);
+}
 
-    // Make the new basic block for the loop header, inserting after current
-    // block.
-    BasicBlock * LoopBB = BasicBlock::Create(*TheContext, "loop", TheFunction);
+void IfExprAST::forEachChild(function_ref<void(ExprAST *)> Fn) {
+  Fn(Cond);
+  for (ExprAST *E : Then)
+    Fn(E);
+  if (isElse)
+    Fn(Else);
+}
+/// codegenLoop - emit the loop itself as a counted loop
+///
+///   guard:     StartVal <= EndVal (>= for downto), else skip to for.end
+///   preheader: store StartVal into the variable
+///   body:      the statements
+///   latch:     leave once the variable reached EndVal, otherwise step it
+///
+/// Testing the variable against the bound before the increment never
+/// overflows, so the step is nsw and LLVM sees the trip count
+/// EndVal - StartVal + 1.
+bool ForExprAST::codegenLoop(AllocaInst *Alloca, Value *StartVal, Value *EndVal) {
+    Function * TheFunction = Builder->GetInsertBlock()->getParent();
 
-    // Insert an explicit fall through from the current block to the LoopBB.
-    Builder->CreateBr(LoopBB);
+    BasicBlock * PreheaderBB = BasicBlock::Create(*TheContext, "for.preheader", TheFunction);
+    BasicBlock * BodyBB = BasicBlock::Create(*TheContext, "for.body", TheFunction);
+    BasicBlock * LatchBB = BasicBlock::Create(*TheContext, "for.latch");
+    BasicBlock * AfterBB = BasicBlock::Create(*TheContext, "for.end");
 
-    // Start insertion in LoopBB.
-    Builder->SetInsertPoint(LoopBB);
+    // An empty range runs the body zero times.
+    Value * NotEmpty = to ? Builder->CreateICmpSLE(StartVal, EndVal, "for.notempty")
+                          : Builder->CreateICmpSGE(StartVal, EndVal, "for.notempty");
+    Builder->CreateCondBr(NotEmpty, PreheaderBB, AfterBB);
 
-    // Within the loop, the variable is defined equal to the PHI node.  If it
-    // shadows an existing variable, we have to restore it, so save it now.
-    AllocaInst * OldVal = NamedValues[VarName];
-    NamedValues[VarName] = Alloca;
+    Builder->SetInsertPoint(PreheaderBB);
+    Builder->CreateStore(StartVal, Alloca);
+    Builder->CreateBr(BodyBB);
 
     // Emit the body of the loop.  This, like any other expr, can change the
     // current BB.  Note that we ignore the value computed by the body, but don't
     // allow an error.
+    Builder->SetInsertPoint(BodyBB);
     for (const auto & body: Body) {
+        emitLocation(body->Loc);
         if (!body->codegen())
-            return nullptr;
+            return false;
     }
-    // Emit the step value.
-    Value * StepVal = nullptr;
+    // the step and the exit test belong to the for statement
+    emitLocation(Loc);
+    Builder->CreateBr(LatchBB);
+
+    TheFunction->getBasicBlockList().push_back(LatchBB);
+    Builder->SetInsertPoint(LatchBB);
+
+    // Reload the variable, the body may have assigned it.
+    Value * CurVar = Builder->CreateLoad(Type::getInt32Ty(*TheContext), Alloca, Symbols.str(VarName));
+    Value * Done;
+    Value * NextVar;
     if (Step) {
-        StepVal = Step->codegen();
+        // an explicit step may jump over the bound, stop once past it; a
+        // step that leaves the i32 range is past any bound, without the
+        // overflow test it would wrap and the loop would never end
+        Value * StepVal = Step->codegen();
         if (!StepVal)
-            return nullptr;
+            return false;
+        Value * Stepped = Builder->CreateBinaryIntrinsic(
+            to ? Intrinsic::sadd_with_overflow : Intrinsic::ssub_with_overflow, CurVar, StepVal);
+        NextVar = Builder->CreateExtractValue(Stepped, 0, "nextvar");
+        Value * Overflow = Builder->CreateExtractValue(Stepped, 1, "for.overflow");
+        Value * Past = to ? Builder->CreateICmpSGT(NextVar, EndVal)
+                          : Builder->CreateICmpSLT(NextVar, EndVal);
+        Done = Builder->CreateOr(Overflow, Past, "for.done");
+    } else {
+        Done = Builder->CreateICmpEQ(CurVar, EndVal, "for.done");
+        NextVar = to ? Builder->CreateNSWAdd(CurVar, Builder->getInt32(1), "nextvar")
+                     : Builder->CreateNSWSub(CurVar, Builder->getInt32(1), "nextvar");
     }
-    else {
-        // If not specified, use 1.0.
-        StepVal = ConstantInt::get(*TheContext, APInt(32, 1, true));
+    Builder->CreateStore(NextVar, Alloca);
+    Builder->CreateCondBr(Done, AfterBB, BodyBB);
+
+    // Any new code will be inserted in AfterBB.
+    TheFunction->getBasicBlockList().push_back(AfterBB);
+    Builder->SetInsertPoint(AfterBB);
+    return true;
+}
+
+/// collectHoistableChecks - array accesses of the body indexed by the loop
+/// variable plus a constant, none if the body may assign the variable, and
+/// none of an array the body may redeclare
+void ForExprAST::collectHoistableChecks(SmallVectorImpl<ArrayExprAST *> &Accesses) {
+    SmallVector<ExprAST *, 32> Nodes;
+    for (ExprAST * E : Body)
+        walk(E, [&](ExprAST * Node) { Nodes.push_back(Node); });
+
+    auto MayWrite = [&](Symbol Var) {
+        return any_of(Nodes, [&](ExprAST * Node) { return Node->mayWrite(Var); });
+    };
+    if (MayWrite(VarName))
+        return;
+
+    for (ExprAST * Node : Nodes) {
+        ArrayExprAST * Access = Node->asArrayAccess();
+        Symbol IndexVar;
+        int64_t Offset;
+        if (Access && !InBoundsAccesses.count(Access)
+            && getArrayType(lookupVariable(Access->getArrayName()))
+            && Access->getIndex()->matchAffine(IndexVar, Offset)
+            && IndexVar == VarName && !MayWrite(Access->getArrayName()))
+            Accesses.push_back(Access);
     }
+}
 
-    // Compute the end condition.
-    Value * EndCond = End->codegen();
-    if (!EndCond)
-        return nullptr;
+Value *ForExprAST::codegen() {
+    Function * TheFunction = Builder->GetInsertBlock()->getParent();
 
-    // Reload, increment, and restore the alloca.  This handles the case where
-    // the body of the loop mutates the variable.
-    Value * CurVar = Builder->CreateLoad(Alloca, VarName.c_str());
-    Value * NextVar;
-    if (to)
-        NextVar = Builder->CreateAdd(CurVar, StepVal, "nextvar");
-    else
-        NextVar = Builder->CreateSub(CurVar, StepVal, "nextvar");
+    // Create an alloca for the variable in the entry block.
+    AllocaInst * Alloca = CreateEntryBlockAlloca(TheFunction, Symbols.str(VarName));
 
-    Builder->CreateStore(NextVar, Alloca);
+    // Emit the start code first, without 'variable' in scope.
+    Value * StartVal = Start->codegen();
+    if (!StartVal)
+        return nullptr;
 
-    // Convert condition to a bool by comparing non-equal to 0.0.
-    EndCond = Builder->CreateICmpNE(EndCond, CurVar, "loopcond");
+    // The final value is computed once, before the first iteration, as in
+    // Pascal.
+    Value * EndVal = End->codegen();
+    if (!EndVal)
+        return nullptr;
 
-    // Create the "after loop" block and insert it.
-    BasicBlock * AfterBB = BasicBlock::Create(*TheContext, "afterloop", TheFunction);
+    // Within the loop, the variable is defined equal to the PHI node.  If it
+    // shadows an existing variable, we have to restore it, so save it now.
+    AllocaInst * OldVal = NamedValues[VarName];
+    NamedValues[VarName] = Alloca;
 
-    // Insert the conditional branch into the end of LoopEndBB.
-    Builder->CreateCondBr(EndCond, LoopBB, AfterBB);
+    // With --bounds-check, accesses X[I + c] are checked once for the whole
+    // range of I: one copy of the loop runs without their checks when the
+    // range fits every such array, the other keeps them.
+    // Only the outermost such loop is versioned, the code of a nest would
+    // double with every level otherwise.
+    SmallVector<ArrayExprAST *, 8> Accesses;
+    if (BoundsCheck && !Step && !InVersionedLoop)
+        collectHoistableChecks(Accesses);
+
+    // values of the variable for which all the accesses are in bounds
+    int64_t Min = INT32_MIN, Max = INT32_MAX;
+    for (ArrayExprAST * Access : Accesses) {
+        Value * Array = lookupVariable(Access->getArrayName());
+        int64_t Lo = ArrayLowerBounds.lookup(Array);
+        int64_t Hi = Lo + (int64_t) getArrayType(Array)->getNumElements() - 1;
+        Symbol IndexVar;
+        int64_t Offset;
+        Access->getIndex()->matchAffine(IndexVar, Offset);
+        Min = std::max(Min, Lo - Offset);
+        Max = std::min(Max, Hi - Offset);
+    }
 
-    // Any new code will be inserted in AfterBB.
-    Builder->SetInsertPoint(AfterBB);
+    bool Ok;
+    if (Accesses.empty() || Min > Max) {
+        Ok = codegenLoop(Alloca, StartVal, EndVal);
+    } else {
+        // the loop visits First .. Last, both have to lie in Min .. Max
+        Value * First = to ? StartVal : EndVal;
+        Value * Last = to ? EndVal : StartVal;
+        Value * InRange = Builder->CreateAnd(
+            Builder->CreateAnd(Builder->CreateICmpSGE(First, Builder->getInt32(Min)),
+                               Builder->CreateICmpSLE(First, Last)),
+            Builder->CreateICmpSLE(Last, Builder->getInt32(Max)), "inrange");
+
+        BasicBlock * UncheckedBB = BasicBlock::Create(*TheContext, "loop.unchecked", TheFunction);
+        BasicBlock * CheckedBB = BasicBlock::Create(*TheContext, "loop.checked", TheFunction);
+        BasicBlock * JoinBB = BasicBlock::Create(*TheContext, "loop.join");
+        Builder->CreateCondBr(InRange, UncheckedBB, CheckedBB);
+
+        InVersionedLoop = true;
+        Builder->SetInsertPoint(UncheckedBB);
+        InBoundsAccesses.insert(Accesses.begin(), Accesses.end());
+        Ok = codegenLoop(Alloca, StartVal, EndVal);
+        for (ArrayExprAST * Access : Accesses)
+            InBoundsAccesses.erase(Access);
+        if (Ok) {
+            Builder->CreateBr(JoinBB);
+            Builder->SetInsertPoint(CheckedBB);
+            Ok = codegenLoop(Alloca, StartVal, EndVal);
+        }
+        InVersionedLoop = false;
+        if (Ok) {
+            Builder->CreateBr(JoinBB);
+            TheFunction->getBasicBlockList().push_back(JoinBB);
+            Builder->SetInsertPoint(JoinBB);
+        }
+    }
+    if (!Ok)
+        return nullptr;
 
     // Restore the unshadowed variable.
     if (OldVal)
@@ -456,124 +1075,329 @@ Value *ForExprAST::codegen() {
     return Constant::getNullValue(Type::getInt32Ty(*TheContext));
 }
 
+void ForExprAST::forEachChild(function_ref<void(ExprAST *)> Fn) {
+    Fn(Start);
+    Fn(End);
+    if (Step)
+        Fn(Step);
+    for (ExprAST * E : Body)
+        Fn(E);
+}
+
+bool ForExprAST::mayWrite(Symbol Var) const { return VarName == Var; }
+
+void ForExprAST::markTailCalls(Symbol Result, bool InTail) {
+    // the loop goes on after its last statement
+    markTailCallsIn(Body, Result, false);
+}
+
+Value *WhileExprAST::codegen() {
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+  // The condition is tested on entry and after every iteration, the loop is
+  // only entered through while.cond.
+  BasicBlock *CondBB = BasicBlock::Create(*TheContext, "while.cond", TheFunction);
+  BasicBlock *BodyBB = BasicBlock::Create(*TheContext, "while.body");
+  BasicBlock *AfterBB = BasicBlock::Create(*TheContext, "while.end");
+  Builder->CreateBr(CondBB);
+
+  Builder->SetInsertPoint(CondBB);
+  emitLocation(Cond->Loc);
+  Value *CondV = Cond->codegen();
+  if (!CondV)
+    return nullptr;
+  CondV = Builder->CreateICmpNE(CondV, Builder->getInt32(0), "whilecond");
+  Builder->CreateCondBr(CondV, BodyBB, AfterBB);
+
+  TheFunction->getBasicBlockList().push_back(BodyBB);
+  Builder->SetInsertPoint(BodyBB);
+  for (ExprAST *E : Body) {
+    emitLocation(E->Loc);
+    if (!E->codegen())
+      return nullptr;
+  }
+  emitLocation(Loc);
+  Builder->CreateBr(CondBB);
+
+  TheFunction->getBasicBlockList().push_back(AfterBB);
+  Builder->SetInsertPoint(AfterBB);
+
+  // while expr always returns 0.
+  return Builder->getInt32(0);
+}
+
+void WhileExprAST::markTailCalls(Symbol Result, bool InTail) {
+  markTailCallsIn(Body, Result, false);
+}
+
+void WhileExprAST::forEachChild(function_ref<void(ExprAST *)> Fn) {
+  Fn(Cond);
+  for (ExprAST *E : Body)
+    Fn(E);
+}
+
+Value *ExitExprAST::codegen() {
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+
+  if (ReturnBB)
+    Builder->CreateBr(ReturnBB);
+  else
+    Builder->CreateRet(Builder->getInt32(0)); // exit in the main program
+
+  // statements after exit are unreachable, they still need a block
+  BasicBlock *DeadBB = BasicBlock::Create(*TheContext, "afterexit", TheFunction);
+  Builder->SetInsertPoint(DeadBB);
+  return Builder->getInt32(0);
+}
+
+bool ExitExprAST::isExit() const { return true; }
+
 Value *UnaryExprAST::codegen() {
   Value *OperandV = Operand->codegen();
   if (!OperandV)
     return nullptr;
 
-  Function *F = getFunction(std::string("unary") + Opcode);
+  // comparisons yield 0 / -1, so bitwise not is also the logical one
+  if (Opcode == (char) tok_not)
+    return Builder->CreateNot(OperandV, "nottmp");
+  if (Opcode == '-')
+    return Builder->CreateNeg(OperandV, "negtmp");
+
+  Function *F = getFunction(Symbols.intern(std::string("unary") + Opcode));
   if (!F)
     return LogErrorV("Unknown unary operator");
 
   return Builder->CreateCall(F, OperandV, "unop");
 }
 
-Value *VarExprAST::codegen() {
-  std::vector<AllocaInst *> OldBindings;
+void UnaryExprAST::forEachChild(function_ref<void(ExprAST *)> Fn) { Fn(Operand); }
+
+bool UnaryExprAST::evaluate(int &Result) const {
+  int V;
+  if (!Operand->evaluate(V))
+    return false;
+  if (Opcode == '-')
+    Result = (int) (0u - (uint32_t) V);
+  else if (Opcode == (char) tok_not)
+    Result = ~V;
+  else
+    return false;
+  return true;
+}
 
-  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+bool UnaryExprAST::matchAffine(Symbol &Var, int64_t &Offset) const {
+  if (Opcode != '-' || !Operand->matchAffine(Var, Offset) || Var != Sym_None)
+    return false;
+  Offset = -Offset;
+  return true;
+}
 
-  // Register all variables and emit their initializer.
-  for (unsigned i = 0, e = VarNames.size(); i != e; ++i) {
-    const std::string &VarName = VarNames[i].first;
-    ExprAST *Init = VarNames[i].second.get();
-
-    // Emit the initializer before adding the variable to scope, this prevents
-    // the initializer from referencing the variable itself, and permits stuff
-    // like this:
-    //  var a = 1 in
-    //    var a = a in ...   # refers to outer 'a'.
-    Value *InitVal;
-    if (Init) {
-      InitVal = Init->codegen();
-      if (!InitVal)
-        return nullptr;
-    } else { // If not specified, use 0.
-      InitVal = ConstantInt::get(*TheContext, APInt(32, 0, true));
-    }
+/// getArrayStorageType - [Hi - Lo + 1 x i32] for an array declaration
+static ArrayType *getArrayStorageType(const VarDecl &D) {
+  return ArrayType::get(Builder->getInt32Ty(), (int64_t) D.Hi - D.Lo + 1);
+}
 
-    AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
-    Builder->CreateStore(InitVal, Alloca);
+Value *VarExprAST::codegen() {
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
-    // Remember the old variable binding so that we can restore the binding when
-    // we unrecurse.
-    OldBindings.push_back(NamedValues[VarName]);
+  // Register all variables, they start as zero.
+  for (const VarDecl &D : VarNames) {
+    AllocaInst *Alloca;
+    if (D.IsArray) {
+      ArrayType *AT = getArrayStorageType(D);
+      Alloca = CreateEntryBlockAlloca(TheFunction, Symbols.str(D.Name), AT);
+      Alloca->setAlignment(Align(ArrayAlignment));
+      uint64_t Size = TheModule->getDataLayout().getTypeAllocSize(AT);
+      Builder->CreateMemSet(Alloca, Builder->getInt8(0), Size, Align(ArrayAlignment));
+      ArrayLowerBounds[Alloca] = D.Lo;
+    } else {
+      Alloca = CreateEntryBlockAlloca(TheFunction, Symbols.str(D.Name));
+      Builder->CreateStore(Builder->getInt32(0), Alloca);
+    }
 
     // Remember this binding.
-    NamedValues[VarName] = Alloca;
+    NamedValues[D.Name] = Alloca;
   }
 
   // Return the body computation.
   return TheFunction;
 }
 
+// a declaration rebinds its names and sets them to zero
+bool VarExprAST::mayWrite(Symbol Var) const {
+  for (const VarDecl &D : VarNames)
+    if (D.Name == Var)
+      return true;
+  return false;
+}
+
+ArrayRef<VarDecl> VarExprAST::getDecls() const { return VarNames; }
+
 // inspiration: https://subscription.packtpub.com/book/application_development/9781785280801/2/ch02lvl1sec15/emitting-a-global-variable
 
+/// getOrCreateGlobal - i32 global for a program level name, created on first use
+static GlobalVariable *getOrCreateGlobal(Symbol Name) {
+  GlobalVariable *&gVar = GlobalValues[Name];
+  if (!gVar)
+    gVar = new GlobalVariable(*TheModule, Builder->getInt32Ty(), false,
+                              GlobalValue::InternalLinkage, nullptr, Symbols.str(Name));
+  return gVar;
+}
+
+// program variables are internal: only the program's own code can see them,
+// so LLVM may keep them in registers across calls that do not touch them
 bool /* GlobalVariable * */ VarExprAST::createGlobal(){
   for (const auto & v : VarNames){
-    TheModule->getOrInsertGlobal(v.first, Builder->getInt32Ty());
-    GlobalVariable *gVar = TheModule->getNamedGlobal(v.first);
-    gVar->setLinkage(GlobalValue::ExternalLinkage);
+    if (v.IsArray) {
+      ArrayType *AT = getArrayStorageType(v);
+      auto *gVar = new GlobalVariable(*TheModule, AT, false, GlobalValue::InternalLinkage,
+                                      ConstantAggregateZero::get(AT), Symbols.str(v.Name));
+      gVar->setAlignment(Align(ArrayAlignment));
+      GlobalValues[v.Name] = gVar;
+      ArrayLowerBounds[gVar] = v.Lo;
+      continue;
+    }
+    GlobalVariable *gVar = getOrCreateGlobal(v.Name);
     gVar->setInitializer(ConstantInt::get(*TheContext, APInt(32, 0, true)));
   }
     // return gVar;
   return true;
 }
 
-Value *ConstExprAST::codegen() {
-  std::vector<AllocaInst *> OldBindings;
+// constants were evaluated by the parser, every use is an immediate
+Value *ConstExprAST::codegen() { return Builder->getInt32(0); }
 
-  Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
-  // Register all variables and emit their initializer.
-  for (unsigned i = 0, e = VarNames.size(); i != e; ++i) {
-    const std::string &VarName = VarNames[i].first;
-    ExprAST *Init = VarNames[i].second.get();
-
-    // Emit the initializer before adding the variable to scope, this prevents
-    // the initializer from referencing the variable itself, and permits stuff
-    // like this:
-    //  var a = 1 in
-    //    var a = a in ...   # refers to outer 'a'.
-    Value *InitVal;
-    if (Init) {
-      InitVal = Init->codegen();
-      if (!InitVal)
-        return nullptr;
-    } else { // If not specified, use 0.
-      InitVal = ConstantInt::get(*TheContext, APInt(32, 0, true));
-    }
+void ConstExprAST::forEachChild(function_ref<void(ExprAST *)> Fn) {
+  for (const auto &V : VarNames)
+    if (V.second)
+      Fn(V.second);
+}
 
-    AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
-    Builder->CreateStore(InitVal, Alloca);
+bool ConstExprAST::createGlobal() { return true; }
 
-    // Remember the old variable binding so that we can restore the binding when
-    // we unrecurse.
-    OldBindings.push_back(NamedValues[VarName]);
+//===----------------------------------------------------------------------===//
+// AST dumping (--dump-ast)
+//===----------------------------------------------------------------------===//
 
-    // Remember this binding.
-    NamedValues[VarName] = Alloca;
+/// printOp - spelling of a binary / unary operator stored as a char
+static raw_ostream &printOp(raw_ostream &OS, char Op) {
+  switch (Op) {
+    case (char) tok_notequal:     return OS << "<>";
+    case (char) tok_lessequal:    return OS << "<=";
+    case (char) tok_greaterequal: return OS << ">=";
+    case (char) tok_assign:       return OS << ":=";
+    case (char) tok_eq:           return OS << "==";
+    case (char) tok_or:           return OS << "or";
+    case (char) tok_and:          return OS << "and";
+    case (char) tok_xor:          return OS << "xor";
+    case (char) tok_mod:          return OS << "mod";
+    case (char) tok_div:          return OS << "div";
+    case (char) tok_not:          return OS << "not";
   }
+  return OS << Op;
+}
 
-  // Return the body computation.
-  return TheFunction;
+static void dumpList(raw_ostream &OS, unsigned Indent, StringRef Label,
+                     ArrayRef<ExprAST *> List) {
+  OS.indent(Indent * 2) << Label << "\n";
+  for (const ExprAST *E : List)
+    E->dump(OS, Indent + 1);
 }
 
+static void dumpDecls(raw_ostream &OS, unsigned Indent, StringRef Label,
+                      ArrayRef<std::pair<Symbol, ExprAST *>> Decls) {
+  OS.indent(Indent * 2) << Label << "\n";
+  for (const auto &D : Decls) {
+    OS.indent((Indent + 1) * 2) << Symbols.str(D.first) << "\n";
+    if (D.second)
+      D.second->dump(OS, Indent + 2);
+  }
+}
 
-bool ConstExprAST::createGlobal(){
-  int varNo = 0;
-  for (const auto & v : VarNames){
-    TheModule->getOrInsertGlobal(v.first, Builder->getInt32Ty());
-    GlobalVariable *gVar = TheModule->getNamedGlobal(v.first);
-    gVar->setLinkage(GlobalValue::ExternalLinkage);
-    ExprAST *Init = VarNames[varNo].second.get();
-    if (Init){
-      if(auto InitVal = Init->codegen()){
-        gVar->setInitializer(dyn_cast<llvm::ConstantInt>(InitVal));  
-      } else return false;
-    }
-    varNo++;
+void NumberExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << "Number " << Val << "\n";
+}
+
+void VariableExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << "Variable " << Symbols.str(Name) << "\n";
+}
+
+void ArrayExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << "Element " << Symbols.str(Name) << "\n";
+  Index->dump(OS, Indent + 1);
+}
+
+void BinaryExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  printOp(OS.indent(Indent * 2) << "Binary '", Op) << "'\n";
+  LHS->dump(OS, Indent + 1);
+  RHS->dump(OS, Indent + 1);
+}
+
+void CallExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << "Call " << Symbols.str(Callee) << "\n";
+  for (const ExprAST *A : Args)
+    A->dump(OS, Indent + 1);
+}
+
+void IfExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << "If\n";
+  Cond->dump(OS, Indent + 1);
+  dumpList(OS, Indent, "Then", Then);
+  if (isElse) {
+    OS.indent(Indent * 2) << "Else\n";
+    Else->dump(OS, Indent + 1);
   }
-    // return gVar;
-  return true;
-}
\ No newline at end of file
+}
+
+void ForExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << "For " << Symbols.str(VarName)
+                        << (to ? " to" : " downto") << "\n";
+  Start->dump(OS, Indent + 1);
+  End->dump(OS, Indent + 1);
+  dumpList(OS, Indent, "Do", Body);
+}
+
+void WhileExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << "While\n";
+  Cond->dump(OS, Indent + 1);
+  dumpList(OS, Indent, "Do", Body);
+}
+
+void ExitExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << "Exit\n";
+}
+
+void UnaryExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  printOp(OS.indent(Indent * 2) << "Unary '", Opcode) << "'\n";
+  Operand->dump(OS, Indent + 1);
+}
+
+void VarExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << "Var\n";
+  for (const VarDecl &D : VarNames) {
+    OS.indent((Indent + 1) * 2) << Symbols.str(D.Name);
+    if (D.IsArray)
+      OS << " array [" << D.Lo << " .. " << D.Hi << "]";
+    OS << "\n";
+  }
+}
+
+void ConstExprAST::dump(raw_ostream &OS, unsigned Indent) const {
+  dumpDecls(OS, Indent, "Const", VarNames);
+}
+
+void PrototypeAST::dump(raw_ostream &OS, unsigned Indent) const {
+  OS.indent(Indent * 2) << (isProcedure ? "Procedure " : "Function ")
+                        << Symbols.str(Name) << "(";
+  for (unsigned i = 0; i < Args.size(); i++)
+    OS << (i ? ", " : "") << Symbols.str(Args[i]);
+  OS << ")\n";
+}
+
+void FunctionAST::dump(raw_ostream &OS, unsigned Indent) const {
+  Proto->dump(OS, Indent);
+  for (const ExprAST *E : Body)
+    if (E)
+      E->dump(OS, Indent + 1);
+}
@@ -10,6 +10,9 @@
 #include <vector>
 
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/Support/TargetSelect.h"
@@ -18,6 +21,8 @@
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Scalar/GVN.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/raw_ostream.h"
 
 
 #include "llvm/IR/LegacyPassManager.h"
@@ -32,48 +37,156 @@
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 
+#include "Lexer.hpp"
+#include "Symbol.hpp"
+
 
 using namespace llvm;
 
 class PrototypeAST;
+class ArrayExprAST;
+
+/*
+ * ASTArena - bump allocator that owns every AST node and child list of one
+ * compilation unit. Nodes are never deleted one by one, reset() releases the
+ * whole tree at once, so node members must not own memory themselves
+ * (child lists are ArrayRefs into the arena, names are Symbols).
+ */
+class ASTArena {
+public:
+  template <typename T, typename... ArgTs> T *make(ArgTs &&... Args) {
+    ++NumNodes;
+    return new (Alloc.Allocate(sizeof(T), alignof(T))) T(std::forward<ArgTs>(Args)...);
+  }
+
+  /// copy - move a temporary child list into the arena
+  template <typename T> ArrayRef<T> copy(const std::vector<T> &Elems) {
+    if (Elems.empty())
+      return ArrayRef<T>();
+    T *Mem = Alloc.Allocate<T>(Elems.size());
+    std::uninitialized_copy(Elems.begin(), Elems.end(), Mem);
+    return ArrayRef<T>(Mem, Elems.size());
+  }
+
+  void reset() {
+    Alloc.Reset();
+    NumNodes = 0;
+  }
+
+  size_t getNumNodes() const { return NumNodes; }
+  size_t getBytesAllocated() const { return Alloc.getBytesAllocated(); }
+
+private:
+  BumpPtrAllocator Alloc;
+  size_t NumNodes = 0;
+};
 
+// The state of a compilation below is per thread, --batch compiles several
+// units at once.
 
-extern std::unique_ptr<LLVMContext> TheContext;
+// arena of the unit being compiled
+extern thread_local ASTArena AST;
+
+
+extern thread_local std::unique_ptr<LLVMContext> TheContext;
 
 // insert instructions and create new ones
-extern std::unique_ptr<IRBuilder<>> Builder;
+extern thread_local std::unique_ptr<IRBuilder<>> Builder;
 
 // TheModule is an LLVM construct that contains functions and global variables.
-extern std::unique_ptr<Module> TheModule;
+extern thread_local std::unique_ptr<Module> TheModule;
 
 // defined values in the current scope -> LLVM representation
-extern std::map<std::string, AllocaInst *> NamedValues;
+extern thread_local DenseMap<Symbol, AllocaInst *> NamedValues;
 
-// static std::unique_ptr<KaleidoscopeJIT> TheJIT;
-extern std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+// program level variables and constants -> their LLVM globals
+extern thread_local DenseMap<Symbol, GlobalVariable *> GlobalValues;
 
-extern std::unique_ptr<legacy::FunctionPassManager> TheFPM;
+// functions already emitted into TheModule
+extern thread_local DenseMap<Symbol, Function *> FunctionValues;
+
+// static std::unique_ptr<KaleidoscopeJIT> TheJIT;
+extern thread_local DenseMap<Symbol, PrototypeAST *> FunctionProtos;
 
 extern ExitOnError ExitOnErr;
 
-extern std::set<std::string> constantVals;
+// values of the program's constants, every use becomes an immediate
+extern thread_local DenseMap<Symbol, int> ConstantValues;
+
+// lower bound of every array variable, by its storage (alloca or global)
+extern thread_local DenseMap<Value *, int> ArrayLowerBounds;
 
-Function *getFunction(std::string Name);
-AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, StringRef VarName);
+Function *getFunction(Symbol Name);
+Value *lookupVariable(Symbol Name);
+AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, StringRef VarName,
+                                   Type *Ty = nullptr);
+ArrayType *getArrayType(Value *Storage);
 
 void writelnFunction();
 void readlnFunction();
 
+/// resetCodegenState - free the module, its context, the AST, every map
+/// pointing into them and the interned symbols; the thread may compile the
+/// next unit afterwards
+void resetCodegenState();
+
+
+/// VarDecl - one declared variable, arrays carry their index range
+struct VarDecl {
+  Symbol Name;
+  bool IsArray = false;
+  int Lo = 0, Hi = 0;
+
+  VarDecl(Symbol Name) : Name(Name) {}
+};
 
 /// ExprAST - Base class for all expression nodes.
 class ExprAST {
 public:
+  /// Loc - first token of the expression, set by the parser
+  SourceLoc Loc;
+
   virtual ~ExprAST() = default;
   virtual Value *codegen() = 0;
 
+  /// dump - print the subtree for --dump-ast, one node per line
+  virtual void dump(raw_ostream &OS, unsigned Indent = 0) const = 0;
+
   virtual bool createGlobal();
 
-  virtual const std::string getName() const;
+  virtual Symbol getName() const;
+
+  /// codegenAddress - storage written by an assignment to this expression
+  virtual Value *codegenAddress();
+
+  /// forEachChild - call Fn on every direct subexpression
+  virtual void forEachChild(function_ref<void(ExprAST *)> Fn);
+
+  /// mayWrite - true if this node itself stores to the variable Var
+  virtual bool mayWrite(Symbol Var) const;
+
+  /// matchAffine - true if the value is Var + Offset, Var is Sym_None for a
+  /// constant
+  virtual bool matchAffine(Symbol &Var, int64_t &Offset) const;
+
+  virtual ArrayExprAST *asArrayAccess();
+
+  /// evaluate - value of a constant expression, false if it needs run time
+  virtual bool evaluate(int &Result) const;
+
+  /// markTailCalls - find the calls whose value the function returns right
+  /// away. InTail is true if nothing but the return follows the statement,
+  /// Result is the variable the function returns (Sym_None in a procedure).
+  virtual void markTailCalls(Symbol Result, bool InTail);
+
+  /// isExit - the statement leaves the function
+  virtual bool isExit() const;
+
+  /// getDecls - variables a var section declares, none for other nodes
+  virtual ArrayRef<VarDecl> getDecls() const;
+
+  /// getCallee - function a call calls, Sym_None for other nodes
+  virtual Symbol getCallee() const;
 };
 
 /// NumberExprAST - Expression class for numeric literals like "1.0".
@@ -84,61 +197,99 @@ public:
   // virtual ~NumberExprAST(){};
   NumberExprAST(int Val) : Val(Val) {}
   Value *codegen() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  bool matchAffine(Symbol &Var, int64_t &Offset) const override;
+  bool evaluate(int &Result) const override;
 };
 
 /// VariableExprAST - Expression class for referencing a variable, like "a".
 class VariableExprAST : public ExprAST {
-  std::string Name;
+  Symbol Name;
+
+public:
+  VariableExprAST(Symbol Name) : Name(Name) {}
+  Value *codegen() override;
+  Value *codegenAddress() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  Symbol getName() const override;
+  bool matchAffine(Symbol &Var, int64_t &Offset) const override;
+  bool evaluate(int &Result) const override;
+};
+
+/// ArrayExprAST - Expression class for an array element, like "X[I]".
+class ArrayExprAST : public ExprAST {
+  Symbol Name;
+  ExprAST *Index;
 
 public:
-  VariableExprAST(std::string Name) : Name(Name) {}
+  ArrayExprAST(Symbol Name, ExprAST *Index) : Name(Name), Index(Index) {}
   Value *codegen() override;
-  const std::string getName() const override;
+  Value *codegenAddress() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  void forEachChild(function_ref<void(ExprAST *)> Fn) override;
+  ArrayExprAST *asArrayAccess() override;
+
+  Symbol getArrayName() const { return Name; }
+  ExprAST *getIndex() const { return Index; }
 };
 
 /// BinaryExprAST - Expression class for a binary operator.
 class BinaryExprAST : public ExprAST {
   char Op;
-  std::unique_ptr<ExprAST> LHS, RHS;
+  ExprAST *LHS, *RHS;
 
 public:
-  BinaryExprAST(char op, std::unique_ptr<ExprAST> LHS,
-                std::unique_ptr<ExprAST> RHS)
-    : Op(op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+  BinaryExprAST(char op, ExprAST *LHS, ExprAST *RHS)
+    : Op(op), LHS(LHS), RHS(RHS) {}
   Value *codegen() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  void forEachChild(function_ref<void(ExprAST *)> Fn) override;
+  bool mayWrite(Symbol Var) const override;
+  bool matchAffine(Symbol &Var, int64_t &Offset) const override;
+  bool evaluate(int &Result) const override;
+  void markTailCalls(Symbol Result, bool InTail) override;
 };
 
 /// CallExprAST - Expression class for function calls.
 class CallExprAST : public ExprAST {
-  std::string Callee;
-  std::vector<std::unique_ptr<ExprAST>> Args;
+  Symbol Callee;
+  ArrayRef<ExprAST *> Args;
+  bool IsTail = false; // the caller returns what the call returns
+
+  Value *codegenTailCall(Function *CalleeF, ArrayRef<Value *> ArgsV);
 
 public:
-  CallExprAST(const std::string &Callee,
-              std::vector<std::unique_ptr<ExprAST>> Args)
-    : Callee(Callee), Args(std::move(Args)) {}
+  CallExprAST(Symbol Callee, ArrayRef<ExprAST *> Args)
+    : Callee(Callee), Args(Args) {}
   Value *codegen() override;
-
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  void forEachChild(function_ref<void(ExprAST *)> Fn) override;
+  bool mayWrite(Symbol Var) const override;
+  void markTailCalls(Symbol Result, bool InTail) override;
+  Symbol getCallee() const override;
 };
 
 /// PrototypeAST - This class represents the "prototype" for a function,
 /// which captures its name, and its argument names (thus implicitly the number
 /// of arguments the function takes).
 class PrototypeAST {
-  std::string Name;
-  std::vector<std::string> Args;
+  Symbol Name;
+  ArrayRef<Symbol> Args;
   bool IsOperator;
   unsigned Precedence;  // Precedence if a binary op.
 
 public:
   bool isProcedure;
-  PrototypeAST(const std::string &name, std::vector<std::string> Args,
+  SourceLoc Loc; // the function name
+  PrototypeAST(Symbol name, ArrayRef<Symbol> Args,
                bool IsOperator = false, unsigned Prec = 0, bool isProcedure = false)
-  : Name(name), Args(std::move(Args)), IsOperator(IsOperator),
+  : Name(name), Args(Args), IsOperator(IsOperator),
     Precedence(Prec), isProcedure(isProcedure) {}
 
   Function *codegen();
-  const std::string & getName() const;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const;
+  Symbol getName() const;
+  ArrayRef<Symbol> getArgs() const;
 
   bool isUnaryOp() const;
   bool isBinaryOp() const;
@@ -150,88 +301,138 @@ public:
 
 /// FunctionAST - This class represents a function definition itself.
 class FunctionAST {
-  std::unique_ptr<PrototypeAST> Proto;
-  std::vector<std::unique_ptr<ExprAST>> Body;
+  PrototypeAST *Proto;
+  ArrayRef<ExprAST *> Body;
 
 public:
   bool isProcedure;
-  FunctionAST(std::unique_ptr<PrototypeAST> Proto,
-              std::vector<std::unique_ptr<ExprAST>> Body,
+  FunctionAST(PrototypeAST *Proto,
+              ArrayRef<ExprAST *> Body,
               bool isProcedure = false)
-    : Proto(std::move(Proto)), Body(std::move(Body)), isProcedure(isProcedure) {}
+    : Proto(Proto), Body(Body), isProcedure(isProcedure) {}
   Function *codegen();
+  void dump(raw_ostream &OS, unsigned Indent = 0) const;
+  PrototypeAST *getProto() const { return Proto; }
+
+  /// forEachNode - call Fn on every node of the body
+  void forEachNode(function_ref<void(ExprAST *)> Fn) const;
+
+  /// references - true if the body uses the program level variable Name,
+  /// i.e. Name is not a parameter, the result or a variable of its own
+  bool references(Symbol Name) const;
 };
 
 /// IfExprAST - Expression class for if/then/else.
 class IfExprAST : public ExprAST {
-  std::unique_ptr<ExprAST> Cond, Else;
-  std::vector<std::unique_ptr<ExprAST>> Then;
+  ExprAST *Cond, *Else;
+  ArrayRef<ExprAST *> Then;
 
 public:
   bool isElse;
-  IfExprAST(std::unique_ptr<ExprAST> Cond, std::vector<std::unique_ptr<ExprAST>> Then,
-            std::unique_ptr<ExprAST> Else, bool isElse)
-    : Cond(std::move(Cond)), Then(std::move(Then)), 
-      Else(std::move(Else)) , isElse(isElse ) {}
+  IfExprAST(ExprAST *Cond, ArrayRef<ExprAST *> Then,
+            ExprAST *Else, bool isElse)
+    : Cond(Cond), Then(Then), 
+      Else(Else) , isElse(isElse ) {}
   
-  IfExprAST(std::unique_ptr<ExprAST> Cond, std::vector<std::unique_ptr<ExprAST>> Then)
-    : Cond(std::move(Cond)), Then(std::move(Then)) {}
+  IfExprAST(ExprAST *Cond, ArrayRef<ExprAST *> Then)
+    : Cond(Cond), Else(nullptr), Then(Then), isElse(false) {}
 
   Value *codegen() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  void forEachChild(function_ref<void(ExprAST *)> Fn) override;
+  void markTailCalls(Symbol Result, bool InTail) override;
 };
 
 /// ForExprAST - Expression class for for/in.
 class ForExprAST : public ExprAST {
   bool to;
-  std::string VarName;
-  std::unique_ptr<ExprAST> Start, End, Step;
-  std::vector<std::unique_ptr<ExprAST>> Body;
-  
+  Symbol VarName;
+  ExprAST *Start, *End, *Step;
+  ArrayRef<ExprAST *> Body;
+
+  bool codegenLoop(AllocaInst *Alloca, Value *StartVal, Value *EndVal);
+  void collectHoistableChecks(SmallVectorImpl<ArrayExprAST *> &Accesses);
 
 public:
-  ForExprAST(const std::string &VarName, std::unique_ptr<ExprAST> Start,
-             std::unique_ptr<ExprAST> End, std::unique_ptr<ExprAST> Step,
-             std::vector<std::unique_ptr<ExprAST>> Body, bool to)
-    : VarName(VarName), Start(std::move(Start)), End(std::move(End)), 
-      Step(std::move(Step)), Body(std::move(Body)), to(to) {}
+  ForExprAST(Symbol VarName, ExprAST *Start,
+             ExprAST *End, ExprAST *Step,
+             ArrayRef<ExprAST *> Body, bool to)
+    : VarName(VarName), Start(Start), End(End), 
+      Step(Step), Body(Body), to(to) {}
+
+  Value *codegen() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  void forEachChild(function_ref<void(ExprAST *)> Fn) override;
+  bool mayWrite(Symbol Var) const override;
+  void markTailCalls(Symbol Result, bool InTail) override;
+};
+
+/// WhileExprAST - Expression class for while/do.
+class WhileExprAST : public ExprAST {
+  ExprAST *Cond;
+  ArrayRef<ExprAST *> Body;
 
+public:
+  WhileExprAST(ExprAST *Cond, ArrayRef<ExprAST *> Body)
+    : Cond(Cond), Body(Body) {}
+
+  Value *codegen() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  void forEachChild(function_ref<void(ExprAST *)> Fn) override;
+  void markTailCalls(Symbol Result, bool InTail) override;
+};
+
+/// ExitExprAST - Expression class for exit, leaves the current function.
+class ExitExprAST : public ExprAST {
+public:
   Value *codegen() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  bool isExit() const override;
 };
 
 /// UnaryExprAST - Expression class for a unary operator.
 class UnaryExprAST : public ExprAST {
   char Opcode;
-  std::unique_ptr<ExprAST> Operand;
+  ExprAST *Operand;
 
 public:
-  UnaryExprAST(char Opcode, std::unique_ptr<ExprAST> Operand)
-    : Opcode(Opcode), Operand(std::move(Operand)) {}
+  UnaryExprAST(char Opcode, ExprAST *Operand)
+    : Opcode(Opcode), Operand(Operand) {}
 
   Value *codegen() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  void forEachChild(function_ref<void(ExprAST *)> Fn) override;
+  bool matchAffine(Symbol &Var, int64_t &Offset) const override;
+  bool evaluate(int &Result) const override;
 };
 
 /// VarExprAST - Expression class for var/in
 class VarExprAST : public ExprAST {
-  std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+  ArrayRef<VarDecl> VarNames;
 
 public:
-  VarExprAST(std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames)
-            : VarNames(std::move(VarNames)) {}
+  VarExprAST(ArrayRef<VarDecl> VarNames)
+            : VarNames(VarNames) {}
 
   Value *codegen() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  bool mayWrite(Symbol Var) const override;
+  ArrayRef<VarDecl> getDecls() const override;
 
   bool createGlobal() override;
 
 };
 
 class ConstExprAST : public ExprAST {
-  std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+  ArrayRef<std::pair<Symbol, ExprAST *>> VarNames;
 
 public:
-  ConstExprAST(std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames) 
-                : VarNames(move(VarNames)) {}
+  ConstExprAST(ArrayRef<std::pair<Symbol, ExprAST *>> VarNames) 
+                : VarNames(VarNames) {}
 
   Value * codegen() override;
+  void dump(raw_ostream &OS, unsigned Indent = 0) const override;
+  void forEachChild(function_ref<void(ExprAST *)> Fn) override;
 
   bool createGlobal() override;
 
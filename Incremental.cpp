@@ -0,0 +1,168 @@
+#include "Incremental.hpp"
+#include "Cache.hpp"
+#include "Diagnostics.hpp"
+#include "Optimizer.hpp"
+#include "Options.hpp"
+#include "Target.hpp"
+
+#include <memory>
+#include <set>
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+static thread_local TargetMachine *TheTargetMachine;
+
+// in source order, main is linked in front of them
+static thread_local std::vector<std::string> FunctionObjects;
+
+// the objects of FunctionObjects, removed at exit or when the thread
+// compiles its next unit
+static thread_local std::vector<std::unique_ptr<FileRemover>> TemporaryObjects;
+
+static thread_local unsigned NumReused = 0, NumCompiled = 0;
+
+void initializeIncremental(TargetMachine &TM) {
+    TheTargetMachine = &TM;
+    FunctionObjects.clear();
+    TemporaryObjects.clear();
+    NumReused = NumCompiled = 0;
+}
+
+bool incrementalEnabled() {
+    const UnitOptions &Opts = getUnitOptions();
+    return Incremental && cacheEnabled() && !Opts.CompileOnly && !Opts.EmitLLVM && !WholeProgram;
+}
+
+/// describeFunction - what the object of F depends on besides the options:
+/// its AST, the signatures of its callees, the constants it reads and the
+/// program variables it uses (Globals)
+static std::string describeFunction(const FunctionAST &F, ArrayRef<GlobalVariable *> Globals) {
+    std::string Description;
+    raw_string_ostream OS(Description);
+    F.dump(OS);
+    OS << (F.isProcedure ? "procedure" : "function") << "\n";
+
+    // sorted, the order of the hash maps must not change the key
+    std::set<std::string> Uses;
+    F.forEachNode([&](ExprAST *Node) {
+        Symbol Callee = Node->getCallee();
+        if (Callee != Sym_None) {
+            std::string Use = "call " + Symbols.str(Callee).str();
+            if (PrototypeAST *P = FunctionProtos.lookup(Callee))
+                Use += "/" + std::to_string(P->getArgs().size()) +
+                       (P->isProcedure ? " procedure" : " function");
+            Uses.insert(Use);
+        }
+        auto C = ConstantValues.find(Node->getName());
+        if (C != ConstantValues.end())
+            Uses.insert("const " + Symbols.str(C->first).str() + " = " + std::to_string(C->second));
+    });
+    for (GlobalVariable *G : Globals) {
+        std::string Use;
+        raw_string_ostream US(Use);
+        US << "var " << G->getName() << " : " << *G->getValueType() << " from "
+           << ArrayLowerBounds.lookup(G);
+        Uses.insert(US.str());
+    }
+
+    for (const std::string &Use : Uses)
+        OS << Use << "\n";
+    return OS.str();
+}
+
+/// compileFunction - generate F alone into a module of its own and compile
+/// it to Object; Globals are declared there, their definitions stay in main
+static bool compileFunction(FunctionAST &F, ArrayRef<GlobalVariable *> Globals,
+                            StringRef Object) {
+    PrototypeAST &P = *F.getProto();
+    std::unique_ptr<Module> MainModule = std::move(TheModule);
+    TheModule = std::make_unique<Module>(Symbols.str(P.getName()), *TheContext);
+    TheModule->setTargetTriple(MainModule->getTargetTriple());
+    TheModule->setDataLayout(MainModule->getDataLayout());
+
+    DenseMap<Symbol, Function *> MainFunctions;
+    DenseMap<Symbol, GlobalVariable *> MainGlobals;
+    std::swap(FunctionValues, MainFunctions);
+    std::swap(GlobalValues, MainGlobals);
+
+    for (GlobalVariable *G : Globals) {
+        auto *Decl = new GlobalVariable(*TheModule, G->getValueType(), false,
+                                        GlobalValue::ExternalLinkage, nullptr, G->getName());
+        Decl->setAlignment(G->getAlign());
+        GlobalValues[Symbols.intern(G->getName())] = Decl;
+        if (ArrayLowerBounds.count(G))
+            ArrayLowerBounds[Decl] = ArrayLowerBounds.lookup(G);
+    }
+    readlnFunction();
+    writelnFunction();
+
+    bool Ok = F.codegen() != nullptr;
+    std::string Error;
+    if (Ok) {
+        optimizeModule(*TheModule);
+        Ok = emitObjectFile(*TheModule, *TheTargetMachine, Object, Error);
+        if (!Ok)
+            diags() << "error: " << Error << "\n";
+    }
+
+    // the declarations go away with the module, addresses get reused
+    for (auto &G : GlobalValues)
+        ArrayLowerBounds.erase(G.second);
+    std::swap(FunctionValues, MainFunctions);
+    std::swap(GlobalValues, MainGlobals);
+    TheModule = std::move(MainModule);
+    return Ok;
+}
+
+bool codegenFunctionCached(FunctionAST &F) {
+    // main and the other functions call F through a declaration
+    PrototypeAST &P = *F.getProto();
+    FunctionProtos[P.getName()] = &P;
+
+    // the object refers to the program variables by name
+    std::vector<GlobalVariable *> Globals;
+    for (auto &G : GlobalValues) {
+        if (F.references(G.first)) {
+            G.second->setLinkage(GlobalValue::ExternalLinkage);
+            Globals.push_back(G.second);
+        }
+    }
+
+    std::string Key = computeCacheKey("function", describeFunction(F, Globals), *TheTargetMachine);
+
+    // the link reads a copy: another compilation storing into the cache,
+    // in this process or not, may prune the entry before the link runs
+    SmallString<128> Object;
+    if (auto EC = sys::fs::createTemporaryFile("mila", "o", Object)) {
+        diags() << "Could not create temporary file: " << EC.message() << "\n";
+        return false;
+    }
+    auto Remover = std::make_unique<FileRemover>(Object);
+    if (fetchFromCache(Key, Object)) {
+        ++NumReused;
+    } else {
+        if (!compileFunction(F, Globals, Object))
+            return false;
+        ++NumCompiled;
+        storeInCache(Key, Object);
+    }
+    FunctionObjects.push_back(std::string(Object));
+    TemporaryObjects.push_back(std::move(Remover));
+    return true;
+}
+
+ArrayRef<std::string> getFunctionObjects() {
+    return FunctionObjects;
+}
+
+void reportIncrementalResult() {
+    if (CacheStats)
+        diags() << "incremental: " << NumReused << " functions reused, " << NumCompiled
+                << " compiled\n";
+}
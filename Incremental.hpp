@@ -0,0 +1,39 @@
+#ifndef PJPPROJECT_INCREMENTAL_HPP
+#define PJPPROJECT_INCREMENTAL_HPP
+
+#include <string>
+
+#include "ExprAst.hpp"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/Target/TargetMachine.h"
+
+/*
+ * Per-function cache of --incremental. Every function is generated,
+ * optimized and compiled alone into an object of its own, kept in
+ * --cache-dir under a hash of its AST, of the signatures of the functions
+ * it calls and of the program variables and constants it uses. A function
+ * nobody touched is taken from the cache, only main and the edited
+ * functions are compiled before the final link. Functions are no longer
+ * inlined into each other, there is no module with all of them.
+ */
+
+/// initializeIncremental - functions are compiled for TM
+void initializeIncremental(llvm::TargetMachine &TM);
+
+/// incrementalEnabled - --incremental with the cache in use, for programs
+/// that are linked here (not -c or --emit-llvm) and without --whole-program
+bool incrementalEnabled();
+
+/// codegenFunctionCached - take the object of F from the cache or compile
+/// F into a new one, false if its codegen failed
+bool codegenFunctionCached(FunctionAST &F);
+
+/// getFunctionObjects - the objects of all functions, linked with main
+llvm::ArrayRef<std::string> getFunctionObjects();
+
+/// reportIncrementalResult - print how many functions were reused with
+/// --cache-stats
+void reportIncrementalResult();
+
+#endif //PJPPROJECT_INCREMENTAL_HPP
@@ -0,0 +1,56 @@
+#include "JIT.hpp"
+#include "ExprAst.hpp"
+#include "Optimizer.hpp"
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/MC/SubtargetFeature.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+// fce.c, built into the compiler under names of its own, so that --run
+// tests the same runtime that executables are linked with
+extern "C" {
+int milaJITWriteln(int x);
+int milaJITWrite(int x);
+int milaJITReadln(int *x);
+int milaJITReadlnArray(int *a, int n);
+void milaJITBoundsError(int index, int lo, int hi);
+void milaJITFlush(void);
+}
+
+int runModule(std::unique_ptr<Module> M, std::unique_ptr<LLVMContext> Ctx, TargetMachine &TM) {
+    // same code as the object file would get
+    JITTargetMachineBuilder JTMB(TM.getTargetTriple());
+    JTMB.setCPU(TM.getTargetCPU().str());
+    JTMB.getFeatures() = SubtargetFeatures(TM.getTargetFeatureString());
+    JTMB.setCodeGenOptLevel(getCodeGenOptLevel());
+
+    auto J = ExitOnErr(LLJITBuilder().setJITTargetMachineBuilder(std::move(JTMB)).create());
+
+    auto &JD = J->getMainJITDylib();
+    MangleAndInterner Mangle(J->getExecutionSession(), J->getDataLayout());
+    auto Runtime = [&](void *Fn) {
+        return JITEvaluatedSymbol(pointerToJITTargetAddress(Fn), JITSymbolFlags::Exported);
+    };
+    ExitOnErr(JD.define(absoluteSymbols({
+        { Mangle("writeln"), Runtime((void *) &milaJITWriteln) },
+        { Mangle("write"),   Runtime((void *) &milaJITWrite) },
+        { Mangle("readln"),  Runtime((void *) &milaJITReadln) },
+        { Mangle("readlnArray"), Runtime((void *) &milaJITReadlnArray) },
+        { Mangle("milaBoundsError"), Runtime((void *) &milaJITBoundsError) },
+    })));
+    // anything else the backend may call (memset, memcpy, ...) comes from libc
+    JD.addGenerator(ExitOnErr(DynamicLibrarySearchGenerator::GetForCurrentProcess(
+        J->getDataLayout().getGlobalPrefix())));
+
+    ExitOnErr(J->addIRModule(ThreadSafeModule(std::move(M), std::move(Ctx))));
+
+    auto MainSym = ExitOnErr(J->lookup("main"));
+    auto *Main = jitTargetAddressToFunction<int (*)()>(MainSym.getAddress());
+    int Result = Main();
+    milaJITFlush();
+    return Result;
+}
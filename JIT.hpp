@@ -0,0 +1,21 @@
+#ifndef PJPPROJECT_JIT_HPP
+#define PJPPROJECT_JIT_HPP
+
+#include <memory>
+
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+/*
+ * In-process execution for --run. The optimized module is compiled by ORC
+ * LLJIT for the same CPU and features as the object file would be, the
+ * runtime functions are bound to the copy of fce.c built into the
+ * compiler, so nothing is written to disk, linked or spawned.
+ */
+
+/// runModule - JIT compile M and call its main, returns main's result
+int runModule(std::unique_ptr<llvm::Module> M, std::unique_ptr<llvm::LLVMContext> Ctx,
+              llvm::TargetMachine &TM);
+
+#endif //PJPPROJECT_JIT_HPP
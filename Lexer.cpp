@@ -1,154 +1,234 @@
 #include "Lexer.hpp"
 
+#include <cstring>
+
 /*
- * Function to return the next token from standard input
- * the variable 'm_IdentifierStr' is set there in case of an identifier,
- * the variable 'm_NumVal' is set there in case of a number.
+ * Lexer::next returns the next token from its source buffer.
+ * Identifiers and keywords carry their spelling in TokenInfo::Text,
+ * numbers their value in TokenInfo::NumVal.
  */
 
-std::string m_IdentifierStr;
-int m_NumVal;
+Lexer::Lexer(const SourceBuffer & Source)
+    : CurPtr(Source.begin()), BufEnd(Source.end()), LineStart(Source.begin()) {}
+
+// read next character, EOF at the end of the buffer
+inline int Lexer::nextChar() {
+    if (CurPtr == BufEnd)
+        return EOF;
+    int C = (unsigned char) *CurPtr++;
+    if (C == '\n') {
+        Line++;
+        LineStart = CurPtr;
+    }
+    return C;
+}
+
+// look at the next character without consuming it
+inline int Lexer::peekChar() const {
+    if (CurPtr == BufEnd)
+        return EOF;
+    return (unsigned char) *CurPtr;
+}
+
+SourceLoc Lexer::locOf(const char * Ptr) const {
+    SourceLoc Loc;
+    Loc.Line = Line;
+    Loc.Col = (unsigned) (Ptr - LineStart) + 1;
+    return Loc;
+}
 
-    //   ;                  < = >           !           |
-bool isTwoCharOp(char c){
-    if (c != 59 && ( (c < 63 && c > 57)  || c == 33 || c == 124)) return true;
-    return false;
+// value of a digit in the given base, -1 if it is not one
+static int digitValue(int C, int Base) {
+    int V;
+    if (isdigit(C))
+        V = C - '0';
+    else if (isalpha(C))
+        V = tolower(C) - 'a' + 10;
+    else
+        return -1;
+    return V < Base ? V : -1;
 }
 
-int gettok() {
-
-    static int LastChar = ' ';
-
-    // Skip any whitespace.
-    while (isspace(LastChar))
-        LastChar = getchar();
-
-   if (isalpha(LastChar)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
-        m_IdentifierStr = LastChar;
-        while (isalnum((LastChar = getchar())))
-            m_IdentifierStr += LastChar;
-        if (m_IdentifierStr == "function")
-            return tok_function;
-        if (m_IdentifierStr == "program")
-            return tok_program;
-        if (m_IdentifierStr == "begin")
-            return tok_begin;
-        if (m_IdentifierStr == "end")
-            return tok_end;
-        if (m_IdentifierStr == "integer")
-            return tok_integer;
-        if (m_IdentifierStr == "exit")
-            return tok_exit;
-        if (m_IdentifierStr == "forward")
-            return tok_forward;
-        if (m_IdentifierStr == "if")
-            return tok_if;
-        if (m_IdentifierStr == "then")
-            return tok_then;
-        if (m_IdentifierStr == "else")
-            return tok_else;
-        if (m_IdentifierStr == "for")
-            return tok_for;
-        if (m_IdentifierStr == "to")
-            return tok_to;
-        if (m_IdentifierStr == "do")
-            return tok_do;
-        if (m_IdentifierStr == "var")
-            return tok_var;
-        if (m_IdentifierStr == "const")
-            return tok_const;
-        if (m_IdentifierStr == "downto")
-            return tok_downto;
-        if (m_IdentifierStr == "procedure")
-            return tok_procedure;
-        return tok_identifier;
+// convert [Begin, End) in the given base, stops at the first invalid digit
+static int parseNumber(const char * Begin, const char * End, int Base) {
+    long long Val = 0;
+    for (const char * P = Begin; P != End; ++P) {
+        int D = digitValue((unsigned char) *P, Base);
+        if (D < 0)
+            break;
+        Val = Val * Base + D;
     }
+    return (int) Val;
+}
 
+#define KEYWORD(Spelling, Tok) \
+    if (memcmp(Str, Spelling, Len) == 0) return Tok;
 
-    if (isdigit(LastChar)) { // Decimal [0-9]+
-        std::string NumStr;
-        do {
-            NumStr += LastChar;
-            LastChar = getchar();
-        } while (isdigit(LastChar));
-
-        m_NumVal = (int) strtod(NumStr.c_str(), nullptr);
-        return tok_number;
+/*
+ * Keyword recognition: switch on the length, then on the first character,
+ * and confirm with a single memcmp. Every keyword has a unique
+ * (length, first character) pair except the few spelled out below, so an
+ * identifier costs one or two comparisons instead of a chain of 17.
+ */
+int keywordToken(const char * Str, size_t Len) {
+    switch (Len) {
+    case 2:
+        switch (Str[0]) {
+        case 'd': KEYWORD("do", tok_do) break;
+        case 'i': KEYWORD("if", tok_if) break;
+        case 'o': KEYWORD("of", tok_of) KEYWORD("or", tok_or) break;
+        case 't': KEYWORD("to", tok_to) break;
+        }
+        break;
+    case 3:
+        switch (Str[0]) {
+        case 'a': KEYWORD("and", tok_and) break;
+        case 'd': KEYWORD("div", tok_div) break;
+        case 'e': KEYWORD("end", tok_end) break;
+        case 'f': KEYWORD("for", tok_for) break;
+        case 'm': KEYWORD("mod", tok_mod) break;
+        case 'n': KEYWORD("not", tok_not) break;
+        case 'v': KEYWORD("var", tok_var) break;
+        case 'x': KEYWORD("xor", tok_xor) break;
+        }
+        break;
+    case 4:
+        switch (Str[0]) {
+        case 'e': KEYWORD("else", tok_else) KEYWORD("exit", tok_exit) break;
+        case 't': KEYWORD("then", tok_then) break;
+        }
+        break;
+    case 5:
+        switch (Str[0]) {
+        case 'a': KEYWORD("array", tok_array) break;
+        case 'b': KEYWORD("begin", tok_begin) break;
+        case 'c': KEYWORD("const", tok_const) break;
+        case 'w': KEYWORD("while", tok_while) break;
+        }
+        break;
+    case 6:
+        switch (Str[0]) {
+        case 'd': KEYWORD("downto", tok_downto) break;
+        case 'r': KEYWORD("readln", tok_readln) break;
+        }
+        break;
+    case 7:
+        switch (Str[0]) {
+        case 'f': KEYWORD("forward", tok_forward) break;
+        case 'i': KEYWORD("integer", tok_integer) break;
+        case 'p': KEYWORD("program", tok_program) break;
+        case 'w': KEYWORD("writeln", tok_writeln) break;
+        }
+        break;
+    case 8:
+        KEYWORD("function", tok_function)
+        break;
+    case 9:
+        KEYWORD("procedure", tok_procedure)
+        break;
     }
+    return tok_identifier;
+}
+
+#undef KEYWORD
+
+TokenInfo Lexer::next() {
+    TokenInfo Tok;
 
-    if (LastChar == '&') { // Hex number [0-9]+
-        LastChar = getchar();
-        std::string NumStr;
-        do {
-            NumStr += LastChar;
-            LastChar = getchar();
-        } while (isdigit(LastChar));
-        char * pend;
-        m_NumVal = (int) strtol(NumStr.c_str(), &pend, 8);
-        return tok_number;
+    while (true) {
+        // Skip any whitespace.
+        while (isspace(LastChar))
+            LastChar = nextChar();
+
+        if (LastChar != '#')
+            break;
+
+        // Comment until end of line.
+        do
+            LastChar = nextChar();
+        while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
     }
 
-    if (LastChar == '$') { // octal number: [0-9]+
-        LastChar = getchar();
-        std::string NumStr;
-        do {
-            NumStr += LastChar;
-            LastChar = getchar();
-        } while (isdigit(LastChar)||isalnum(LastChar));
-        char * pend;
-        m_NumVal = (int) strtol(NumStr.c_str(), &pend, 16);
-        return tok_number;
+    // Check for end of file.  Don't eat the EOF.
+    if (LastChar == EOF) {
+        Tok.Kind = tok_eof;
+        Tok.Loc = locOf(CurPtr);
+        return Tok;
     }
 
+    // LastChar has been consumed already, the token starts one char back
+    const char * TokStart = CurPtr - 1;
+    Tok.Loc = locOf(TokStart);
+
+    if (isalpha(LastChar)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
+        while (isalnum(peekChar()))
+            CurPtr++;
+        Tok.Text = std::string_view(TokStart, CurPtr - TokStart);
+        Tok.Kind = keywordToken(TokStart, CurPtr - TokStart);
+        LastChar = nextChar();
+        return Tok;
+    }
 
-    if (LastChar == '#') {
-    // Comment until end of line.
-    do
-        LastChar = getchar();
-    while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+    if (isdigit(LastChar)) { // Decimal [0-9]+
+        while (isdigit(peekChar()))
+            CurPtr++;
+        Tok.Text = std::string_view(TokStart, CurPtr - TokStart);
+        Tok.NumVal = parseNumber(TokStart, CurPtr, 10);
+        Tok.Kind = tok_number;
+        LastChar = nextChar();
+        return Tok;
+    }
 
-    if (LastChar != EOF)
-        return gettok();
+    if (LastChar == '&' || LastChar == '$') { // octal &[0-7]+, hex $[0-9a-f]+
+        int Base = LastChar == '&' ? 8 : 16;
+        const char * DigitStart = CurPtr;
+        while (Base == 8 ? isdigit(peekChar()) : isalnum(peekChar()))
+            CurPtr++;
+        Tok.Text = std::string_view(TokStart, CurPtr - TokStart);
+        Tok.NumVal = parseNumber(DigitStart, CurPtr, Base);
+        Tok.Kind = tok_number;
+        LastChar = nextChar();
+        return Tok;
     }
 
     // two character operators
-    if (isTwoCharOp(LastChar)){
-        std::string expressionStr;
-        expressionStr = LastChar;
-
-        // read character without removing it from steam
-        while(isTwoCharOp(std::cin.peek())){
-            LastChar= getchar();
-            expressionStr += LastChar;
-            if (expressionStr == "<="){
-                LastChar = getchar();
-                return tok_lessequal;
-            }else if(expressionStr == ">=")   {
-                LastChar = getchar();
-                return tok_greaterequal;
-            }else if(expressionStr == ":=")   {
-                LastChar = getchar();
-                return tok_assign;
-            }else if(expressionStr == "!=")   {
-                LastChar = getchar();
-                return tok_notequal;
-            }else if(expressionStr == "||")   {
-                LastChar = getchar();
-                return tok_or;
-            }else if(expressionStr == "==")   {
-                LastChar = getchar();
-                return tok_eq;
-            }
-        }
+    int Next = peekChar();
+    int TwoChar = 0;
+    switch (LastChar) {
+    case '<':
+        if (Next == '=') TwoChar = tok_lessequal;
+        if (Next == '>') TwoChar = tok_notequal;
+        break;
+    case '>':
+        if (Next == '=') TwoChar = tok_greaterequal;
+        break;
+    case ':':
+        if (Next == '=') TwoChar = tok_assign;
+        break;
+    case '!':
+        if (Next == '=') TwoChar = tok_notequal;
+        break;
+    case '=':
+        if (Next == '=') TwoChar = tok_eq;
+        break;
+    case '|':
+        if (Next == '|') TwoChar = tok_or;
+        break;
+    case '.':
+        if (Next == '.') TwoChar = tok_dotdot;
+        break;
+    }
+    if (TwoChar) {
+        nextChar();
+        Tok.Text = std::string_view(TokStart, 2);
+        Tok.Kind = TwoChar;
+        LastChar = nextChar();
+        return Tok;
     }
-
-    // Check for end of file.  Don't eat the EOF.
-    if (LastChar == EOF)
-        return tok_eof;
 
     // Otherwise, just return the character as its ascii value.
-    int ThisChar = LastChar;
-    LastChar = getchar();
-    return ThisChar;
-
-}
\ No newline at end of file
+    Tok.Text = std::string_view(TokStart, 1);
+    Tok.Kind = LastChar;
+    LastChar = nextChar();
+    return Tok;
+}
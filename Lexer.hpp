@@ -4,10 +4,9 @@
 #include <iostream>
 #include <set>
 #include <string>
+#include <string_view>
 
-extern std::string m_IdentifierStr;
-extern  int m_NumVal;
-int gettok();
+#include "SourceBuffer.hpp"
 
 
 /*
@@ -50,15 +49,67 @@ enum Token {
     tok_eq =            -25,
 
     // 3-character operators (keywords)
-    tok_mod =           -25,
-    tok_div =           -26,
-    tok_not =           -27,
-    tok_and =           -28,
-    tok_xor =           -29,
+    tok_mod =           -26,
+    tok_div =           -27,
+    tok_not =           -28,
+    tok_and =           -29,
+    tok_xor =           -30,
 
     // keywords in for loop
-    tok_to =            -30,
-    tok_downto =        -31
+    tok_to =            -31,
+    tok_downto =        -32,
+
+    // array declarations
+    tok_array =         -33,
+    tok_of =            -34,
+    tok_dotdot =        -37,
+
+    // builtin procedures
+    tok_readln =        -35,
+    tok_writeln =       -36
+};
+
+/// keywordToken - token of the keyword spelled [Str, Str + Len),
+/// tok_identifier if the identifier is not a keyword
+int keywordToken(const char * Str, size_t Len);
+
+/// SourceLoc - 1-based line and column of a token in its source buffer.
+struct SourceLoc {
+    unsigned Line = 0;
+    unsigned Col = 0;
+};
+
+/// TokenInfo - a single token produced by the lexer. Text is a view into the
+/// source buffer (no copy), it stays valid as long as the SourceBuffer lives.
+struct TokenInfo {
+    int Kind = tok_eof;
+    SourceLoc Loc;
+    std::string_view Text;
+    int NumVal = 0;       // value of tok_number
+};
+
+/*
+ * Lexer turns one source buffer into a stream of tokens.
+ * All the scanning state lives in the object, so independent Lexers can
+ * run over different buffers at the same time (e.g. on several threads).
+ */
+class Lexer {
+public:
+    explicit Lexer(const SourceBuffer & Source);
+
+    /// next - scan and return the next token, tok_eof at the end of the buffer
+    TokenInfo next();
+
+private:
+    int nextChar();
+    int peekChar() const;
+    SourceLoc locOf(const char * Ptr) const;
+
+    const char * CurPtr;      // next unread character
+    const char * BufEnd;
+    const char * LineStart;   // first character of the current line
+    unsigned Line = 1;
+    int LastChar = ' ';       // one character of lookahead, already consumed
 };
 
 #endif //PJPPROJECT_LEXER_HPP
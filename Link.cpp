@@ -0,0 +1,41 @@
+#include "Link.hpp"
+
+#include <vector>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Program.h"
+
+using namespace llvm;
+
+// both are set by CMake, the defaults only serve builds without it
+#ifndef MILA_CC
+#define MILA_CC "cc"
+#endif
+#ifndef MILA_RUNTIME
+#define MILA_RUNTIME "libmilart.a"
+#endif
+
+bool linkExecutable(ArrayRef<std::string> Objects, StringRef Output, std::string &Error) {
+    auto Driver = sys::findProgramByName(MILA_CC);
+    if (!Driver) {
+        Error = "cannot find the linker driver " MILA_CC ": " + Driver.getError().message();
+        return false;
+    }
+
+    std::vector<StringRef> Args = { *Driver };
+    Args.insert(Args.end(), Objects.begin(), Objects.end());
+    Args.insert(Args.end(), { MILA_RUNTIME, "-o", Output });
+    int RC = sys::ExecuteAndWait(*Driver, Args, None, {}, 0, 0, &Error);
+    if (RC != 0 && Error.empty())
+        Error = MILA_CC " failed to link " + Output.str();
+    return RC == 0;
+}
+
+std::string describeLinker() {
+    std::string Description = MILA_CC "|" MILA_RUNTIME;
+    sys::fs::file_status Status;
+    if (!sys::fs::status(MILA_RUNTIME, Status))
+        Description += "|" + std::to_string(Status.getSize()) + "|" +
+                       std::to_string(sys::toTimeT(Status.getLastModificationTime()));
+    return Description;
+}
@@ -0,0 +1,24 @@
+#ifndef PJPPROJECT_LINK_HPP
+#define PJPPROJECT_LINK_HPP
+
+#include <string>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+
+/*
+ * Final link of a compiled program. The fce.c runtime is built once into
+ * a static archive next to the compiler, a program is linked against it
+ * by a single run of the C compiler driver the archive was built with.
+ */
+
+/// linkExecutable - link Objects with the runtime archive into Output,
+/// false with Error set if the driver is missing or the link failed
+bool linkExecutable(llvm::ArrayRef<std::string> Objects, llvm::StringRef Output,
+                    std::string &Error);
+
+/// describeLinker - the driver and the runtime archive with its size and
+/// time, a rebuilt runtime gives a different description
+std::string describeLinker();
+
+#endif //PJPPROJECT_LINK_HPP
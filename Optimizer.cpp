@@ -0,0 +1,79 @@
+#include "Optimizer.hpp"
+#include "Options.hpp"
+
+#include <memory>
+
+#include "llvm/Passes/PassBuilder.h"
+
+using namespace llvm;
+
+static thread_local std::unique_ptr<PassBuilder> ThePB;
+
+// analysis managers shared by the function and the module pipelines
+static thread_local std::unique_ptr<LoopAnalysisManager> TheLAM;
+static thread_local std::unique_ptr<FunctionAnalysisManager> TheFAM;
+static thread_local std::unique_ptr<CGSCCAnalysisManager> TheCGAM;
+static thread_local std::unique_ptr<ModuleAnalysisManager> TheMAM;
+
+// function simplification pipeline, empty at -O0
+static thread_local std::unique_ptr<FunctionPassManager> TheFPM;
+
+static OptimizationLevel getOptimizationLevel() {
+  switch (OptLevel) {
+    case 0:  return OptimizationLevel::O0;
+    case 1:  return OptimizationLevel::O1;
+    case 2:  return OptimizationLevel::O2;
+    default: return OptimizationLevel::O3;
+  }
+}
+
+CodeGenOpt::Level getCodeGenOptLevel() {
+  switch (OptLevel) {
+    case 0:  return CodeGenOpt::None;
+    case 1:  return CodeGenOpt::Less;
+    case 2:  return CodeGenOpt::Default;
+    default: return CodeGenOpt::Aggressive;
+  }
+}
+
+void initializeOptimizer(TargetMachine *TM) {
+  ThePB = std::make_unique<PassBuilder>(TM);
+
+  TheLAM = std::make_unique<LoopAnalysisManager>();
+  TheFAM = std::make_unique<FunctionAnalysisManager>();
+  TheCGAM = std::make_unique<CGSCCAnalysisManager>();
+  TheMAM = std::make_unique<ModuleAnalysisManager>();
+
+  ThePB->registerModuleAnalyses(*TheMAM);
+  ThePB->registerCGSCCAnalyses(*TheCGAM);
+  ThePB->registerFunctionAnalyses(*TheFAM);
+  ThePB->registerLoopAnalyses(*TheLAM);
+  ThePB->crossRegisterProxies(*TheLAM, *TheFAM, *TheCGAM, *TheMAM);
+
+  OptimizationLevel Level = getOptimizationLevel();
+  if (Level == OptimizationLevel::O0)
+    TheFPM = std::make_unique<FunctionPassManager>();
+  else
+    TheFPM = std::make_unique<FunctionPassManager>(
+        ThePB->buildFunctionSimplificationPipeline(Level, ThinOrFullLTOPhase::None));
+}
+
+void optimizeFunction(Function &F) {
+  TheFPM->run(F, *TheFAM);
+}
+
+void optimizeModule(Module &M) {
+  // functions were changed by codegen after their analyses were cached
+  TheFAM->clear();
+  TheMAM->clear();
+
+  OptimizationLevel Level = getOptimizationLevel();
+  ModulePassManager MPM = Level == OptimizationLevel::O0
+                              ? ThePB->buildO0DefaultPipeline(Level)
+                              : ThePB->buildPerModuleDefaultPipeline(Level);
+  MPM.run(M, *TheMAM);
+
+  // M may be freed next (see Incremental.cpp), nothing cached may outlive it
+  TheFAM->clear();
+  TheMAM->clear();
+}
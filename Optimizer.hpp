@@ -0,0 +1,28 @@
+#ifndef PJPPROJECT_OPTIMIZER_HPP
+#define PJPPROJECT_OPTIMIZER_HPP
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Target/TargetMachine.h"
+
+/*
+ * Optimization pipeline on top of the new pass manager.
+ * The -O level selects PassBuilder's default pipelines: every finished
+ * function goes through the function simplification pipeline right after
+ * its codegen, the whole module through the per-module pipeline at the end.
+ */
+
+/// initializeOptimizer - set up the analysis managers for TM (may be null)
+void initializeOptimizer(llvm::TargetMachine *TM);
+
+/// optimizeFunction - run the function simplification pipeline on F
+void optimizeFunction(llvm::Function &F);
+
+/// optimizeModule - run the per-module default pipeline on M
+void optimizeModule(llvm::Module &M);
+
+/// getCodeGenOptLevel - backend optimization level matching -O
+llvm::CodeGenOpt::Level getCodeGenOptLevel();
+
+#endif //PJPPROJECT_OPTIMIZER_HPP
@@ -0,0 +1,140 @@
+#include "Options.hpp"
+#include "Remarks.hpp"
+
+#include <algorithm>
+
+#include "llvm/Support/Threading.h"
+
+using namespace llvm;
+
+cl::OptionCategory MilaCategory("mila options");
+
+cl::list<std::string> InputFilenames(cl::Positional, cl::ZeroOrMore,
+    cl::desc("<input file (stdin if none)> or, with --batch, <input files>"),
+    cl::cat(MilaCategory));
+
+cl::opt<std::string> OutputFilename("o", cl::desc("Output file (default output.out, output.o with -c)"),
+                                    cl::value_desc("filename"), cl::cat(MilaCategory));
+
+cl::opt<bool> CompileOnly("c", cl::desc("Only write the object file, do not link"),
+                          cl::init(false), cl::cat(MilaCategory));
+
+cl::opt<bool> EmitLLVM("emit-llvm", cl::desc("Write the optimized LLVM IR instead of machine code"),
+                       cl::init(false), cl::cat(MilaCategory));
+
+cl::list<IRDumpPoint> DumpIR("dump-ir", cl::CommaSeparated,
+    cl::desc("Print the LLVM module to stderr"),
+    cl::values(clEnumValN(DumpAfterCodegen, "after-codegen", "right after IR generation"),
+               clEnumValN(DumpAfterOpt, "after-opt", "after the optimization passes")),
+    cl::cat(MilaCategory));
+
+cl::opt<bool> DumpAST("dump-ast", cl::desc("Print the AST of every top-level item to stderr"),
+                      cl::init(false), cl::cat(MilaCategory));
+
+cl::opt<unsigned> OptLevel("O", cl::Prefix, cl::ZeroOrMore, cl::init(2),
+    cl::desc("Optimization level: -O0, -O1, -O2 or -O3 (default -O2)"),
+    cl::value_desc("level"), cl::cat(MilaCategory));
+
+cl::opt<std::string> MCPU("mcpu", cl::init("generic"),
+    cl::desc("Target CPU (-march is an alias), 'native' for the host CPU and its features (default generic)"),
+    cl::value_desc("cpu-name"), cl::cat(MilaCategory));
+
+cl::alias MArch("march", cl::desc("Alias for -mcpu"), cl::aliasopt(MCPU),
+                  cl::cat(MilaCategory));
+
+cl::list<std::string> MAttrs("mattr", cl::CommaSeparated,
+    cl::desc("Target features to enable (+feat) or disable (-feat)"),
+    cl::value_desc("a1,+a2,-a3,..."), cl::cat(MilaCategory));
+
+cl::opt<std::string> MTune("mtune",
+    cl::desc("CPU to tune the generated code for, 'native' for the host CPU"),
+    cl::value_desc("cpu-name"), cl::cat(MilaCategory));
+
+cl::opt<bool> BoundsCheck("bounds-check",
+    cl::desc("Check array indexes at run time, checks of for loops over a whole range are done once"),
+    cl::init(false), cl::cat(MilaCategory));
+
+cl::opt<bool> WholeProgram("whole-program",
+    cl::desc("Nothing outside calls the functions: all but main are internal and use fastcc"),
+    cl::init(false), cl::cat(MilaCategory));
+
+cl::opt<std::string> RemarksFilter("remarks",
+    cl::desc("Print optimization remarks of the passes matching the regex, e.g. 'loop-vectorize|inline'"),
+    cl::value_desc("regex"), cl::cat(MilaCategory));
+
+cl::opt<std::string> RemarksFile("remarks-file",
+    cl::desc("Write optimization remarks as YAML (all passes unless --remarks is given)"),
+    cl::value_desc("filename"), cl::cat(MilaCategory));
+
+cl::opt<std::string> CacheDir("cache-dir",
+    cl::desc("Reuse the output of an identical earlier compilation kept in this directory"),
+    cl::value_desc("directory"), cl::cat(MilaCategory));
+
+cl::opt<std::string> CachePolicy("cache-policy",
+    cl::init("prune_interval=1m:prune_after=168h:cache_size_bytes=1g"),
+    cl::desc("Limits of --cache-dir, least recently used entries go first "
+             "(default prune_interval=1m:prune_after=168h:cache_size_bytes=1g)"),
+    cl::value_desc("policy"), cl::cat(MilaCategory));
+
+cl::opt<bool> CacheStats("cache-stats", cl::desc("Print hits, misses and the size of --cache-dir"),
+                         cl::init(false), cl::cat(MilaCategory));
+
+cl::opt<bool> Incremental("incremental",
+    cl::desc("With --cache-dir, compile every function into an object of its own and "
+             "reuse the objects of unchanged functions"),
+    cl::init(false), cl::cat(MilaCategory));
+
+cl::opt<unsigned> Jobs("j", cl::Prefix, cl::init(1),
+    cl::desc("Split the optimized program and generate machine code on N threads (-j0: all cores); "
+             "with --batch, compile N files at once (default all cores)"),
+    cl::value_desc("N"), cl::cat(MilaCategory));
+
+cl::opt<bool> Batch("batch",
+    cl::desc("Compile every input file on its own into <name>.out (<name>.o with -c), several at "
+             "once; @file reads further arguments, e.g. the list of files, from file"),
+    cl::init(false), cl::cat(MilaCategory));
+
+cl::opt<std::string> ServeSocket("serve",
+    cl::desc("Stay running and compile the sources sent to this Unix socket by mila --connect"),
+    cl::value_desc("socket"), cl::cat(MilaCategory));
+
+cl::opt<std::string> ConnectSocket("connect",
+    cl::desc("Let the mila --serve server on this Unix socket compile (or --run) the input"),
+    cl::value_desc("socket"), cl::cat(MilaCategory));
+
+cl::opt<bool> RunProgram("run", cl::desc("Compile the program in memory and run it instead of writing output.o"),
+                         cl::init(false), cl::cat(MilaCategory));
+
+static thread_local const UnitOptions *CurrentUnitOptions = nullptr;
+
+const UnitOptions &getUnitOptions() {
+    if (CurrentUnitOptions)
+        return *CurrentUnitOptions;
+    // the command line is parsed before anything is compiled
+    static const UnitOptions CommandLine = { CompileOnly, EmitLLVM };
+    return CommandLine;
+}
+
+void setUnitOptions(const UnitOptions *Opts) {
+    CurrentUnitOptions = Opts;
+}
+
+bool shouldDumpIR(IRDumpPoint Point) {
+    return std::find(DumpIR.begin(), DumpIR.end(), Point) != DumpIR.end();
+}
+
+std::string getOutputFilename() {
+    if (!OutputFilename.empty())
+        return OutputFilename;
+    if (EmitLLVM)
+        return "output.ll";
+    return CompileOnly ? "output.o" : "output.out";
+}
+
+unsigned getCodegenJobs() {
+    if (getUnitOptions().CompileOnly || Batch || remarksEnabled())
+        return 1;
+    if (Jobs == 0)
+        return heavyweight_hardware_concurrency().compute_thread_count();
+    return Jobs;
+}
@@ -0,0 +1,74 @@
+#ifndef PJPPROJECT_OPTIONS_HPP
+#define PJPPROJECT_OPTIONS_HPP
+
+#include <string>
+
+#include "llvm/Support/CommandLine.h"
+
+/*
+ * Command line options of the compiler. They are parsed once in main(),
+ * the rest of the compiler only reads them.
+ */
+
+/// points of the pipeline at which --dump-ir prints the module
+enum IRDumpPoint {
+    DumpAfterCodegen,
+    DumpAfterOpt,
+};
+
+/// all mila options, --help hides the ones LLVM registers itself
+extern llvm::cl::OptionCategory MilaCategory;
+
+extern llvm::cl::list<std::string> InputFilenames;
+extern llvm::cl::opt<std::string> OutputFilename;
+extern llvm::cl::opt<bool> CompileOnly;
+extern llvm::cl::opt<bool> EmitLLVM;
+extern llvm::cl::list<IRDumpPoint> DumpIR;
+extern llvm::cl::opt<bool> DumpAST;
+extern llvm::cl::opt<unsigned> OptLevel;
+extern llvm::cl::opt<std::string> MCPU;
+extern llvm::cl::list<std::string> MAttrs;
+extern llvm::cl::opt<std::string> MTune;
+extern llvm::cl::opt<bool> RunProgram;
+extern llvm::cl::opt<bool> BoundsCheck;
+extern llvm::cl::opt<bool> WholeProgram;
+extern llvm::cl::opt<std::string> RemarksFilter;
+extern llvm::cl::opt<std::string> RemarksFile;
+extern llvm::cl::opt<std::string> CacheDir;
+extern llvm::cl::opt<std::string> CachePolicy;
+extern llvm::cl::opt<bool> CacheStats;
+extern llvm::cl::opt<bool> Incremental;
+extern llvm::cl::opt<unsigned> Jobs;
+extern llvm::cl::opt<bool> Batch;
+extern llvm::cl::opt<std::string> ServeSocket;
+extern llvm::cl::opt<std::string> ConnectSocket;
+
+/// UnitOptions - what one compilation writes: an executable, the object file
+/// (-c) or the optimized IR (--emit-llvm). The command line decides for
+/// every unit, a --serve request for its own, so the compiler reads them
+/// through getUnitOptions() instead of -c and --emit-llvm
+struct UnitOptions {
+    bool CompileOnly = false;
+    bool EmitLLVM = false;
+};
+
+/// getUnitOptions - the options of the unit this thread compiles
+const UnitOptions &getUnitOptions();
+
+/// setUnitOptions - Opts for what this thread compiles from now on, nullptr
+/// for the command line again; Opts must outlive its use
+void setUnitOptions(const UnitOptions *Opts);
+
+/// shouldDumpIR - true if --dump-ir asked for the module at this point
+bool shouldDumpIR(IRDumpPoint Point);
+
+/// getOutputFilename - -o, otherwise output.o with -c, output.ll with
+/// --emit-llvm and output.out without either
+std::string getOutputFilename();
+
+/// getCodegenJobs - threads of the backend: -j, all cores for -j0, one for
+/// -c, --batch (-j counts units there) and whenever remarks are collected
+/// (they belong to one context)
+unsigned getCodegenJobs();
+
+#endif //PJPPROJECT_OPTIONS_HPP
@@ -1,10 +1,16 @@
 #include "Parser.hpp"
+#include "Options.hpp"
+#include "Optimizer.hpp"
+#include "Incremental.hpp"
+#include "Diagnostics.hpp"
 
 Parser::Parser() : MilaContext(), MilaBuilder(MilaContext), MilaModule("mila", MilaContext) {
 }
 
-int CurTok;
-std::map<char, int> BinopPrecedence;
+thread_local int CurTok;
+thread_local TokenInfo CurTokInfo;
+thread_local std::unique_ptr<Lexer> TheLexer;
+thread_local std::map<char, int> BinopPrecedence;
 
 bool Parser::Parse() {
     getNextToken();
@@ -33,7 +39,7 @@ const Module& Parser::Generate() {
 
       // call writeln with value from lexel
       MilaBuilder.CreateCall(MilaModule.getFunction("writeln"), {
-        ConstantInt::get(MilaContext, APInt(32, m_NumVal))
+        ConstantInt::get(MilaContext, APInt(32, CurTokInfo.NumVal))
       });
 
       // return 0
@@ -51,7 +57,8 @@ const Module& Parser::Generate() {
  */
 
 int getNextToken() {
-    return CurTok = gettok();
+    CurTokInfo = TheLexer->next();
+    return CurTok = CurTokInfo.Kind;
 }
 
 
@@ -60,7 +67,9 @@ int GetTokPrecedence() {
   // not asci or 2-character operator
   if (!isascii(CurTok)  && CurTok != tok_notequal  && CurTok != tok_lessequal  
                         && CurTok != tok_greaterequal  && CurTok != tok_assign 
-                        && CurTok != tok_or)
+                        && CurTok != tok_or  && CurTok != tok_and
+                        && CurTok != tok_xor && CurTok != tok_mod
+                        && CurTok != tok_div)
     return -1;
 
   // Make sure it's a declared binop.
@@ -91,29 +100,41 @@ void readln(){
 }
 
 /// LogError* - These are little helper functions for error handling.
-std::unique_ptr<ExprAST> LogError(const char *Str) {
-  fprintf(stderr, "Error: %s\n", Str);
+ExprAST *LogError(const char *Str) {
+  diags() << "Error: " << Str << "\n";
   return nullptr;
 }
-std::unique_ptr<PrototypeAST> LogErrorP(const char *Str) {
+PrototypeAST *LogErrorP(const char *Str) {
   LogError(Str);
   return nullptr;
 }
 
- std::unique_ptr<ExprAST> ParseExpression();
+ ExprAST *ParseExpression();
 
 /// numberexpr ::= number
-std::unique_ptr<ExprAST> ParseNumberExpr() {
-  // std::cout  << m_NumVal << " <- opc===============\n";
-  auto Result = std::make_unique<NumberExprAST>(m_NumVal);
+ExprAST *ParseNumberExpr() {
+  auto Result = AST.make<NumberExprAST>(CurTokInfo.NumVal);
   getNextToken(); // consume the number
-  return std::move(Result);
+  return Result;
+}
+
+/// EqualIsComparison - '=' compares instead of assigning, inside conditions
+/// and parentheses
+static thread_local bool EqualIsComparison = false;
+
+/// ParseCondition - expression in which '=' is a comparison
+static ExprAST *ParseCondition() {
+  bool Saved = EqualIsComparison;
+  EqualIsComparison = true;
+  auto Cond = ParseExpression();
+  EqualIsComparison = Saved;
+  return Cond;
 }
 
 /// parenexpr ::= '(' expression ')'
- std::unique_ptr<ExprAST> ParseParenExpr() {
+ ExprAST *ParseParenExpr() {
   getNextToken(); // eat (.
-  auto V = ParseExpression();
+  auto V = ParseCondition();
   if (!V)
     return nullptr;
 
@@ -125,22 +146,34 @@ std::unique_ptr<ExprAST> ParseNumberExpr() {
 
 /// identifierexpr
 ///   ::= identifier
+///   ::= identifier '[' expression ']'
 ///   ::= identifier '(' expression* ')'
- std::unique_ptr<ExprAST> ParseIdentifierExpr() {
-  std::string IdName = m_IdentifierStr;
+ ExprAST *ParseIdentifierExpr() {
+  Symbol IdName = Symbols.intern(CurTokInfo.Text);
 
   getNextToken(); // eat identifier.
 
+  if (CurTok == '[') { // Array element.
+    getNextToken(); // eat [
+    auto Index = ParseExpression();
+    if (!Index)
+      return nullptr;
+    if (CurTok != ']')
+      return LogError("expected ']' after array index");
+    getNextToken(); // eat ]
+    return AST.make<ArrayExprAST>(IdName, Index);
+  }
+
   if (CurTok != '(') // Simple variable ref.
-    return std::make_unique<VariableExprAST>(IdName);
+    return AST.make<VariableExprAST>(IdName);
 
   // Call.
   getNextToken(); // eat (
-  std::vector<std::unique_ptr<ExprAST>> Args;
+  std::vector<ExprAST *> Args;
   if (CurTok != ')') {
     while (true) {
       if (auto Arg = ParseExpression())
-        Args.push_back(std::move(Arg));
+        Args.push_back(Arg);
       else
         return nullptr;
 
@@ -159,15 +192,15 @@ std::unique_ptr<ExprAST> ParseNumberExpr() {
     getNextToken();
   // Eat the ';'.
 
-  return std::make_unique<CallExprAST>(IdName, std::move(Args));
+  return AST.make<CallExprAST>(IdName, AST.copy(Args));
 }
 
 /// ifexpr ::= 'if' expression 'then' expression 'else' expression
- std::unique_ptr<ExprAST> ParseIfExpr() {
+ ExprAST *ParseIfExpr() {
   getNextToken();  // eat the if.
 
   // condition.
-  auto Cond = ParseExpression();
+  auto Cond = ParseCondition();
   if (!Cond)
     return nullptr;
 
@@ -181,13 +214,13 @@ std::unique_ptr<ExprAST> ParseNumberExpr() {
     getNextToken();
   }
 
-  std::vector<std::unique_ptr<ExprAST>> thenBlock;
+  std::vector<ExprAST *> thenBlock;
 
   while(CurTok != tok_end){
     if (auto E = ParseExpression()){
       if (CurTok == ';')
         getNextToken();
-      thenBlock.push_back(move(E));
+      thenBlock.push_back(E);
 
       // nothing left to parse
       if (!if_block) break; 
@@ -210,11 +243,61 @@ std::unique_ptr<ExprAST> ParseNumberExpr() {
     if (!Else)
       return nullptr;
 
-    return std::make_unique<IfExprAST>(std::move(Cond), std::move(thenBlock),
-                                        std::move(Else), isElse);
+    return AST.make<IfExprAST>(Cond, AST.copy(thenBlock),
+                                        Else, isElse);
   }
 
-  return std::make_unique<IfExprAST>(std::move(Cond), std::move(thenBlock));
+  return AST.make<IfExprAST>(Cond, AST.copy(thenBlock));
+}
+
+/// whileexpr ::= 'while' expression 'do' (statement | 'begin' statement* 'end')
+ ExprAST *ParseWhileExpr() {
+  getNextToken();  // eat the while.
+
+  auto Cond = ParseCondition();
+  if (!Cond)
+    return nullptr;
+
+  if (CurTok != tok_do)
+    return LogError("expected do after while condition");
+  getNextToken();  // eat the do.
+
+  bool Block = false;
+  if (CurTok == tok_begin) {
+    Block = true;
+    getNextToken(); // eat begin
+  }
+
+  std::vector<ExprAST *> Body;
+  while (CurTok != tok_end) {
+    if (auto E = ParseExpression()) {
+      if (CurTok == ';')
+        getNextToken(); // eat ;
+      Body.push_back(E);
+
+      // a single statement without begin .. end
+      if (!Block)
+        break;
+    } else {
+      if (CurTok == tok_end)
+        break;
+      return nullptr;
+    }
+  }
+
+  if (Block) {
+    if (CurTok != tok_end)
+      return LogError("expected end after begin (while block)");
+    getNextToken(); // eat end
+  }
+
+  return AST.make<WhileExprAST>(Cond, AST.copy(Body));
+}
+
+/// exitexpr ::= 'exit'
+ ExprAST *ParseExitExpr() {
+  getNextToken();  // eat the exit.
+  return AST.make<ExitExprAST>();
 }
 
 /*
@@ -223,13 +306,13 @@ std::unique_ptr<ExprAST> ParseNumberExpr() {
 */
 
 /// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
- std::unique_ptr<ExprAST> ParseForExpr() {
+ ExprAST *ParseForExpr() {
   getNextToken();  // eat the for.
 
   if (CurTok != tok_identifier)
     return LogError("expected identifier after for");
 
-  std::string IdName = m_IdentifierStr;
+  Symbol IdName = Symbols.intern(CurTokInfo.Text);
   getNextToken();  // eat identifier.
 
   if (CurTok != tok_assign)
@@ -256,7 +339,7 @@ std::unique_ptr<ExprAST> ParseNumberExpr() {
     return nullptr;
 
   // The step value is optional.
-  std::unique_ptr<ExprAST> Step;
+  ExprAST *Step = nullptr;
   if (CurTok == tok_do) {
     getNextToken(); // eat 'do'.
   } else LogError("expected 'do' after for");
@@ -265,18 +348,18 @@ std::unique_ptr<ExprAST> ParseNumberExpr() {
     getNextToken(); // eat 'begin'.
   } else LogError("expected 'begin' after for");
 
-  std::vector<std::unique_ptr<ExprAST>> body;
+  std::vector<ExprAST *> body;
 
   while (CurTok != tok_end) {
     if (auto expr = ParseExpression()) {
         if (CurTok == ';')
             getNextToken(); // eat ;.
-        body.push_back(move(expr));
+        body.push_back(expr);
     }
     else {
         if (CurTok == tok_end) {
             getNextToken(); // eat end
-            return std::make_unique<ForExprAST>(IdName, move(Start), move(End), move(Step), move(body), to);
+            return AST.make<ForExprAST>(IdName, Start, End, Step, AST.copy(body), to);
         }
         return nullptr;
     }
@@ -284,15 +367,77 @@ std::unique_ptr<ExprAST> ParseNumberExpr() {
   if (CurTok == tok_end)
     getNextToken(); // eat end
   
-  return std::make_unique<ForExprAST>(IdName, std::move(Start), std::move(End), 
-                                      std::move(Step), std::move(body), to);
+  return AST.make<ForExprAST>(IdName, Start, End, Step, AST.copy(body), to);
 }
 
 
+/// bound ::= expression
+/// The bound must be a constant expression: numbers, constants and operators.
+static bool ParseArrayBound(int &Bound) {
+  auto E = ParseExpression();
+  if (!E)
+    return false;
+  if (!E->evaluate(Bound)) {
+    LogErrorP("array bound is not a constant expression");
+    return false;
+  }
+  return true;
+}
+
+/// vartype ::= 'integer' | 'array' '[' bound '..' bound ']' 'of' 'integer'
+static bool ParseVarType(VarDecl &Type) {
+  if (CurTok == tok_integer) {
+    getNextToken(); // eat integer
+    return true;
+  }
+  if (CurTok != tok_array) {
+    LogErrorP("expected integer or array type for var");
+    return false;
+  }
+  getNextToken(); // eat array
+
+  if (CurTok != '[') {
+    LogErrorP("expected '[' after array");
+    return false;
+  }
+  getNextToken(); // eat [
+  if (!ParseArrayBound(Type.Lo))
+    return false;
+  if (CurTok != tok_dotdot) {
+    LogErrorP("expected '..' in array bounds");
+    return false;
+  }
+  getNextToken(); // eat ..
+  if (!ParseArrayBound(Type.Hi))
+    return false;
+  if (CurTok != ']') {
+    LogErrorP("expected ']' after array bounds");
+    return false;
+  }
+  getNextToken(); // eat ]
+  if (Type.Hi < Type.Lo) {
+    LogErrorP("array upper bound is below the lower bound");
+    return false;
+  }
+
+  if (CurTok != tok_of) {
+    LogErrorP("expected 'of' after array bounds");
+    return false;
+  }
+  getNextToken(); // eat of
+  if (CurTok != tok_integer) {
+    LogErrorP("expected integer as array element type");
+    return false;
+  }
+  getNextToken(); // eat integer
+  Type.IsArray = true;
+  return true;
+}
+
 /*
 var I, J, TEMP : integer;
 */
-void HandleListVars( std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> & VarNames){
+void HandleListVars( std::vector<VarDecl> & VarNames){
   bool firstIter = true;
   while (1) {
 
@@ -301,13 +446,10 @@ void HandleListVars( std::vector<std::pair<std::string, std::unique_ptr<ExprAST>
     if (!firstIter){
       
       
-      std::string Name = m_IdentifierStr;
+      Symbol Name = Symbols.intern(CurTokInfo.Text);
       getNextToken();  // eat identifier.
 
-      // Read the optional initializer.
-      std::unique_ptr<ExprAST> Init = nullptr;
-      VarNames.emplace_back(Name, std::move(Init));
-      // VarNames.push_back(std::make_pair(Name, std::move(Init)));
+      VarNames.emplace_back(Name);
     }
         
     // End of var list, exit loop.
@@ -327,14 +469,17 @@ void HandleListVars( std::vector<std::pair<std::string, std::unique_ptr<ExprAST>
       return;
     } 
 
-    getNextToken();  // eat ';'.
+    getNextToken();  // eat ':'.
 
-    if (CurTok != tok_integer){
-      LogErrorP("expected integer keyword after 'var'");
+    // every name of the list gets the type
+    VarDecl Type(Sym_None);
+    if (!ParseVarType(Type))
       return;
-    } 
-
-    getNextToken();  // eat ';'.
+    for (VarDecl &D : VarNames) {
+      D.IsArray = Type.IsArray;
+      D.Lo = Type.Lo;
+      D.Hi = Type.Hi;
+    }
 
     if (CurTok != ';'){
       LogErrorP("expected ';' keyword after 'var'");
@@ -350,7 +495,7 @@ var
 */
 
 
-void HandleSequenceVars( std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> & VarNames){
+void HandleSequenceVars( std::vector<VarDecl> & VarNames){
 
   bool firstIter = true;
   while (1) {
@@ -358,23 +503,17 @@ void HandleSequenceVars( std::vector<std::pair<std::string, std::unique_ptr<Expr
     if (CurTok != tok_identifier && !firstIter) break;
 
     if (!firstIter){
-      std::string Name = m_IdentifierStr;
+      Symbol Name = Symbols.intern(CurTokInfo.Text);
       getNextToken();  // eat identifier.
 
-      // Read the optional initializer.
-      std::unique_ptr<ExprAST> Init = nullptr;
-      VarNames.emplace_back(Name, std::move(Init));
-      // VarNames.push_back(std::make_pair(Name, std::move(Init)));
+      VarNames.emplace_back(Name);
     }
         
     if (CurTok == ':') {
       getNextToken(); // eat the ':'.
 
-      if (CurTok != tok_integer){
-        LogErrorP("expected integer after : for var");
+      if (!ParseVarType(VarNames.back()))
         return;
-      }
-      getNextToken(); // eat the 'integer'.
 
       if (CurTok != ';'){
         LogErrorP("expected ; after integer for var");
@@ -394,21 +533,19 @@ void HandleSequenceVars( std::vector<std::pair<std::string, std::unique_ptr<Expr
 
 /// varexpr ::= 'var' identifier ('=' expression)?
 //                    (',' identifier ('=' expression)?)* 'in' expression
- std::unique_ptr<ExprAST> ParseVarExpr() {
+ ExprAST *ParseVarExpr() {
   getNextToken();  // eat the var.
 
-  std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+  std::vector<VarDecl> VarNames;
 
   // At least one variable name is required.
   if (CurTok != tok_identifier)
     return LogError("expected identifier after var");
 
-  std::string Name = m_IdentifierStr;
+  Symbol Name = Symbols.intern(CurTokInfo.Text);
   getNextToken();  // eat identifier.
 
-  std::unique_ptr<ExprAST> Init = nullptr;
-  VarNames.emplace_back(Name, std::move(Init));
-  // VarNames.push_back(std::make_pair(Name, std::move(Init)));
+  VarNames.emplace_back(Name);
   
   if (CurTok == ':'){
     HandleSequenceVars(VarNames);
@@ -421,13 +558,13 @@ void HandleSequenceVars( std::vector<std::pair<std::string, std::unique_ptr<Expr
     return LogError("expected ',' or ':' after identifier for var");
   }
   
-  return std::make_unique<VarExprAST>(std::move(VarNames));
+  return AST.make<VarExprAST>(AST.copy(VarNames));
 }
 
-std::unique_ptr<ExprAST> ParseConstExpr(){
+ExprAST *ParseConstExpr(){
   getNextToken(); // eat 'const'
 
-  std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+  std::vector<std::pair<Symbol, ExprAST *>> VarNames;
 
   if (CurTok != tok_identifier)
     return LogError("expected identifier after 'const'");
@@ -435,23 +572,27 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
   while(1){
     if (CurTok != tok_identifier) break;
 
-    std::string Name = m_IdentifierStr;
-    constantVals.insert(m_IdentifierStr);
+    Symbol Name = Symbols.intern(CurTokInfo.Text);
     getNextToken(); // eat identifier
 
-    std::unique_ptr<ExprAST> Init = nullptr;
+    ExprAST *Init = nullptr;
     if (CurTok == '=') {
       getNextToken(); // eat the '='.
 
       Init = ParseExpression();
       if (!Init)
         return nullptr;
+      // evaluated right away, so later constants and array bounds can use it
+      int Value;
+      if (!Init->evaluate(Value))
+        return LogError("constant is not initialized by a constant expression");
+      ConstantValues[Name] = Value;
     }
     else {
         return LogError("Constant not initialized");
     }
-    VarNames.emplace_back(Name, move(Init));
-    // VarNames.push_back(std::make_pair(Name, std::move(Init)));
+    VarNames.emplace_back(Name, Init);
+    // VarNames.push_back(std::make_pair(Name, Init));
 
       // End of var list, exit loop.
       if (CurTok != ';')
@@ -464,7 +605,7 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
           return LogError("expected identifier list after var99");
   }
 
-  return std::make_unique<ConstExprAST>(move(VarNames));
+  return AST.make<ConstExprAST>(AST.copy(VarNames));
 
 }
 
@@ -475,47 +616,65 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
 ///   ::= parenexpr
 ///   ::= ifexpr
 ///   ::= forexpr
+///   ::= whileexpr
+///   ::= exitexpr
 ///   ::= varexpr
- std::unique_ptr<ExprAST> ParsePrimary() {
+/// setLoc - remember where E starts, null passes through
+static ExprAST *setLoc(ExprAST *E, SourceLoc Loc) {
+  if (E)
+    E->Loc = Loc;
+  return E;
+}
+
+ ExprAST *ParsePrimary() {
+  SourceLoc Loc = CurTokInfo.Loc;
 
   switch (CurTok) {
     default:
       if (CurTok == tok_begin || CurTok == tok_end) return nullptr;
         return LogError("unknown token when expecting an expression");
     case tok_identifier:
-      return ParseIdentifierExpr();
+    case tok_readln:
+    case tok_writeln:
+      return setLoc(ParseIdentifierExpr(), Loc);
     case tok_number:
-      return ParseNumberExpr();
+      return setLoc(ParseNumberExpr(), Loc);
     case '(':
-      return ParseParenExpr();
+      return setLoc(ParseParenExpr(), Loc);
     case tok_if:
-      return ParseIfExpr();
+      return setLoc(ParseIfExpr(), Loc);
     case tok_for:
-      return ParseForExpr();
+      return setLoc(ParseForExpr(), Loc);
+    case tok_while:
+      return setLoc(ParseWhileExpr(), Loc);
+    case tok_exit:
+      return setLoc(ParseExitExpr(), Loc);
     case tok_var:
-      return ParseVarExpr();
+      return setLoc(ParseVarExpr(), Loc);
   }
 }
 
 /// unary
 ///   ::= primary
 ///   ::= '!' unary
- std::unique_ptr<ExprAST> ParseUnary() {
+///   ::= 'not' unary
+ ExprAST *ParseUnary() {
   // If the current token is not an operator, it must be a primary expr.
-  if (!isascii(CurTok) || CurTok == '(' || CurTok == ',')
+  if ((!isascii(CurTok) && CurTok != tok_not) || CurTok == '(' || CurTok == ',')
     return ParsePrimary();
 
   // If this is a unary operator, read it.
   int Opc = CurTok;
+  SourceLoc Loc = CurTokInfo.Loc;
   getNextToken();
   if (auto Operand = ParseUnary())
-    return std::make_unique<UnaryExprAST>(Opc, std::move(Operand));
+    return setLoc(AST.make<UnaryExprAST>(Opc, Operand), Loc);
   return nullptr;
 }
 
 /// binoprhs
 ///   ::= ('+' primary)*
- std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec, std::unique_ptr<ExprAST> LHS) {
+ ExprAST *ParseBinOpRHS(int ExprPrec, ExprAST *LHS) {
   // If this is a binop, find its precedence.
   while (true) {
     int TokPrec = GetTokPrecedence();
@@ -528,6 +687,8 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
     // Okay, we know this is a binop.
     int BinOp = CurTok;
     getNextToken(); // eat binop
+    if (BinOp == '=' && EqualIsComparison)
+      BinOp = tok_eq;
 
     // Parse the primary expression after the binary operator.
     auto RHS = ParseUnary();
@@ -538,31 +699,31 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
     // the pending operator take RHS as its LHS.
     int NextPrec = GetTokPrecedence();
     if (TokPrec < NextPrec) {
-      RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
+      RHS = ParseBinOpRHS(TokPrec + 1, RHS);
       if (!RHS)
         return nullptr;
     }
 
     // Merge LHS/RHS.
-    LHS = std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS));
+    LHS = setLoc(AST.make<BinaryExprAST>(BinOp, LHS, RHS), LHS->Loc);
   }
 }
 
 /// expression
 ///   ::= primary binoprhs
 ///
- std::unique_ptr<ExprAST> ParseExpression() {
+ ExprAST *ParseExpression() {
   auto LHS = ParseUnary();
   if (!LHS)
     return nullptr;
 
-  return ParseBinOpRHS(0, std::move(LHS));
+  return ParseBinOpRHS(0, LHS);
 }
 
 /// prototype
 ///   ::= id '(' id* ')'
- std::unique_ptr<PrototypeAST> ParsePrototype() {
-  bool isProcedure = false; // can be procedure of function
+ PrototypeAST *ParsePrototype(bool isProcedure) {
+  // can be procedure of function, ParseDefinition eats the keyword itself
   if (CurTok == tok_procedure){
     isProcedure = true;
     getNextToken(); // eat 'procedure' or 'forward'
@@ -571,15 +732,16 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
   if (CurTok != tok_identifier)
     return LogErrorP("Expected function name in prototype");
 
-  std::string FnName = m_IdentifierStr;
+  Symbol FnName = Symbols.intern(CurTokInfo.Text);
+  SourceLoc FnLoc = CurTokInfo.Loc;
   getNextToken();
 
   if (CurTok != '(')
     return LogErrorP("Expected '(' in prototype");
 
-  std::vector<std::string> ArgNames;      
+  std::vector<Symbol> ArgNames;
   while (CurTok != ')' && getNextToken() == tok_identifier){
-    ArgNames.push_back(m_IdentifierStr);
+    ArgNames.push_back(Symbols.intern(CurTokInfo.Text));
     getNextToken();
     if (CurTok == ':')
       getNextToken(); // eat :
@@ -610,17 +772,22 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
   }
 
   // change here procedure to true
-  return std::make_unique<PrototypeAST>(FnName, std::move(ArgNames), false, 0, isProcedure);
+  auto Proto = AST.make<PrototypeAST>(FnName, AST.copy(ArgNames), false, 0, isProcedure);
+  Proto->Loc = FnLoc;
+  return Proto;
 }
 
+/// ForwardDeclared - the last definition only declared its function
+static thread_local bool ForwardDeclared = false;
+
 /// definition ::= 'def' prototype expression
 
- std::unique_ptr<FunctionAST> ParseDefinition() {
+ FunctionAST *ParseDefinition() {
   bool isProcedure = false;
   if (CurTok == tok_procedure)
     isProcedure = true;
   getNextToken(); // eat function.
-  auto Proto = ParsePrototype();
+  auto Proto = ParsePrototype(isProcedure);
   if (!Proto)
     return nullptr;
 
@@ -646,10 +813,14 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
   // if (CurTok == ':')
     // getNextToken(); // eat ;
 
-  if (m_IdentifierStr == "forward"){
+  ForwardDeclared = false;
+  if (CurTok == tok_forward){
     getNextToken(); // eat forward/
     if (CurTok == ';')
       getNextToken(); // eat ;
+    // calls before the body is defined use the prototype
+    FunctionProtos[Proto->getName()] = Proto;
+    ForwardDeclared = true;
     return nullptr;
   }
 
@@ -657,7 +828,7 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
     LogErrorP("Expected begin");
   }
 
-  std::vector<std::unique_ptr<ExprAST>> astExprs;
+  std::vector<ExprAST *> astExprs;
 
   if (CurTok == tok_var)
     astExprs.push_back(ParseExpression());
@@ -670,31 +841,22 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
     else if (auto E = ParseExpression()){
       if (CurTok == ';')
         getNextToken();
-      astExprs.push_back(std::move(E));
+      astExprs.push_back(E);
     } else  {
       if (CurTok == tok_end) break;
       return nullptr;
     }
   }
-  return std::make_unique<FunctionAST>(std::move(Proto), std::move(astExprs), isProcedure);  
+  return AST.make<FunctionAST>(Proto, AST.copy(astExprs), isProcedure);  
 }
 
 /// toplevelexpr ::= expression
-
- std::unique_ptr<FunctionAST> ParseTopLevelExpr() {
-  std::vector<std::unique_ptr<ExprAST>> vecBody;
-  if (auto E = ParseExpression()) {
-    // Make an anonymous proto.
-    auto Proto = std::make_unique<PrototypeAST>("main",
-                                                std::vector<std::string>());
-    vecBody.push_back(std::move(E)); 
-    return std::make_unique<FunctionAST>(std::move(Proto), std::move(vecBody), false);
-  }
-  return nullptr;
+ ExprAST *ParseTopLevelExpr() {
+  return ParseExpression();
 }
 
 /// external ::= 'forward' prototype
- std::unique_ptr<PrototypeAST> ParseForward() {
+ PrototypeAST *ParseForward() {
   getNextToken(); // eat forward.
   return ParsePrototype();
 }
@@ -703,41 +865,37 @@ std::unique_ptr<ExprAST> ParseConstExpr(){
 // Top-Level parsing
 //===----------------------------------------------------------------------===//
 
-void InitializeModuleAndPassManager() {
+void InitializeModuleAndPassManager(TargetMachine *TM) {
   // Open a new module.
   TheContext = std::make_unique<LLVMContext>();
   TheModule = std::make_unique<Module>("mila", *TheContext);
 
+  // Let the passes see the real target while functions are optimized.
+  if (TM) {
+    TheModule->setTargetTriple(TM->getTargetTriple().str());
+    TheModule->setDataLayout(TM->createDataLayout());
+  }
+
   // Create a new builder for the module.
   Builder = std::make_unique<IRBuilder<>>(*TheContext);
 
-  // Create a new pass manager attached to it.
-  TheFPM = std::make_unique<legacy::FunctionPassManager>(TheModule.get());
-
-  // Promote allocas to registers.
-  TheFPM->add(createPromoteMemoryToRegisterPass());
-  // Do simple "peephole" optimizations and bit-twiddling optzns.
-  TheFPM->add(createInstructionCombiningPass());
-  // Reassociate expressions.
-  TheFPM->add(createReassociatePass());
-  // Eliminate Common SubExpressions.
-  TheFPM->add(createGVNPass());
-  // Simplify the control flow graph (deleting unreachable blocks, etc).
-  TheFPM->add(createCFGSimplificationPass());
-
-  TheFPM->doInitialization();
+  // Per-function and module pipelines for the requested -O level.
+  initializeOptimizer(TM);
 }
 
 
+// The whole program is parsed before any code is generated, so that it is
+// known which program variables the functions use.
+static thread_local std::vector<FunctionAST *> ProgramFunctions; // in source order
+static thread_local std::vector<ExprAST *> ProgramVars;          // top-level var sections
+static thread_local std::vector<ExprAST *> ProgramBody;          // statements of main
+
 void HandleDefinition() {
   if (auto FnAST = ParseDefinition()) {
-    if (auto *FnIR = FnAST->codegen()) {
-      fprintf(stderr, "Read function definition:");
-      // FnIR->print(errs());
-      // fprintf(stderr, "\n");
-      // InitializeModuleAndPassManager();
-    }
-  } else {
+    if (DumpAST)
+      FnAST->dump(diags());
+    ProgramFunctions.push_back(FnAST);
+  } else if (!ForwardDeclared) {
     // Skip token for error recovery.
     getNextToken();
   }
@@ -745,12 +903,9 @@ void HandleDefinition() {
 
  void HandleForward() {
   if (auto ProtoAST = ParseForward()) {
-    if (auto *FnIR = ProtoAST->codegen()) {
-      fprintf(stderr, "Read extern: ");
-      // FnIR->print(errs());
-      // fprintf(stderr, "\n");
-      //  FunctionProtos[ProtoAST->getName()] = std::move(ProtoAST);
-    }
+    if (DumpAST)
+      ProtoAST->dump(diags());
+    ProtoAST->codegen();
   } else {
     // Skip token for error recovery.
     getNextToken();
@@ -758,16 +913,9 @@ void HandleDefinition() {
 }
 
  void HandleTopLevelExpression() {
-  // Evaluate a top-level expression into an anonymous function.
-  if (auto FnAST = ParseTopLevelExpr()) {
-    // if (auto *FnIR = FnAST->codegen()) {
-      // fprintf(stderr, "Read top-level expression:");
-      // FnIR->print(errs());
-      // fprintf(stderr, "\n");
-      FnAST->codegen();
-      // Remove the anonymous expression.
-      // FnIR->eraseFromParent();
-    // }
+  // top-level statements make up main
+  if (auto E = ParseTopLevelExpr()) {
+    ProgramBody.push_back(E);
   } else {
     // Skip token for error recovery.
     getNextToken();
@@ -775,12 +923,12 @@ void HandleDefinition() {
 }
 
 void HandleVarGlobal(){
+  SourceLoc Loc = CurTokInfo.Loc;
   if (auto FnAST = ParseVarExpr()) {
-    if (auto result = FnAST->createGlobal()) {
-        fprintf(stderr, "Read Var definition\n");
-          //  TheModule->print(errs(), nullptr);
-          //  fprintf(stderr, "\n");
-    }
+    FnAST->Loc = Loc;
+    if (DumpAST)
+      FnAST->dump(diags());
+    ProgramVars.push_back(FnAST);
   }
   else {
       // Skip token for error recovery.
@@ -790,11 +938,9 @@ void HandleVarGlobal(){
 
 void HandleConstVal(){
  if (auto FnAST = ParseConstExpr()) {
-    if (auto result = FnAST->createGlobal()) {
-        fprintf(stderr, "Read Const definition\n");
-      //  TheModule->print(errs(), nullptr);
-      //  fprintf(stderr, "\n");
-    }
+    if (DumpAST)
+      FnAST->dump(diags());
+    FnAST->createGlobal();
   } else {
     // Skip token for error recovery.
     getNextToken();
@@ -802,7 +948,7 @@ void HandleConstVal(){
 }
 
 /// top ::= definition | external | expression | ';'
-void MainLoop() {
+static void ParseProgram() {
   while (true) {
     switch (CurTok) {
     case tok_eof:
@@ -837,3 +983,56 @@ void MainLoop() {
   }
 }
 
+/// CodegenProgram - generate the parsed program
+///
+/// Scalar program variables no function uses become variables of main,
+/// which mem2reg keeps in registers. Arrays and the variables functions
+/// share stay (internal) globals.
+static void CodegenProgram() {
+  std::vector<VarDecl> MainVars;
+  for (ExprAST *Section : ProgramVars) {
+    std::vector<VarDecl> Globals;
+    for (const VarDecl &D : Section->getDecls()) {
+      bool Shared = D.IsArray || any_of(ProgramFunctions, [&](FunctionAST *F) {
+                      return F->references(D.Name);
+                    });
+      (Shared ? Globals : MainVars).push_back(D);
+    }
+    if (!Globals.empty())
+      AST.make<VarExprAST>(AST.copy(Globals))->createGlobal();
+  }
+
+  // --incremental compiles every function into an object of its own
+  for (FunctionAST *FnAST : ProgramFunctions) {
+    if (incrementalEnabled())
+      codegenFunctionCached(*FnAST);
+    else
+      FnAST->codegen();
+  }
+
+  // main declares the variables it keeps for itself first
+  std::vector<ExprAST *> MainBody;
+  if (!MainVars.empty()) {
+    MainBody.push_back(AST.make<VarExprAST>(AST.copy(MainVars)));
+    MainBody.back()->Loc = ProgramVars.front()->Loc;
+  }
+  MainBody.insert(MainBody.end(), ProgramBody.begin(), ProgramBody.end());
+
+  auto Proto = AST.make<PrototypeAST>(Sym_main, ArrayRef<Symbol>());
+  if (!MainBody.empty())
+    Proto->Loc = MainBody.front()->Loc;
+  auto Main = AST.make<FunctionAST>(Proto, AST.copy(MainBody), false);
+  if (DumpAST)
+    Main->dump(diags());
+  Main->codegen();
+
+  ProgramFunctions.clear();
+  ProgramVars.clear();
+  ProgramBody.clear();
+}
+
+void MainLoop() {
+  ParseProgram();
+  CodegenProgram();
+}
+
@@ -60,43 +60,47 @@ private:
 
 /// BinopPrecedence - This holds the precedence for each binary operator that is
 /// defined.
-extern std::map<char, int> BinopPrecedence;
+extern thread_local std::map<char, int> BinopPrecedence;
 
 
 /// CurTok/getNextToken - Provide a simple token buffer.  CurTok is the current
 /// token the parser is looking at.  getNextToken reads another token from the
 /// lexer and updates CurTok with its results.    
-extern int CurTok;
+extern thread_local int CurTok;
+extern thread_local TokenInfo CurTokInfo;
 int getNextToken();
+
+/// TheLexer - lexer over the source being compiled, set up by main()
+extern thread_local std::unique_ptr<Lexer> TheLexer;
 int GetTokPrecedence();
 
-std::unique_ptr<ExprAST> LogError(const char *Str);
-std::unique_ptr<PrototypeAST> LogErrorP(const char *Str);
+ExprAST *LogError(const char *Str);
+PrototypeAST *LogErrorP(const char *Str);
 
- std::unique_ptr<ExprAST> ParseExpression();
+ ExprAST *ParseExpression();
 
 /// numberexpr ::= number
- std::unique_ptr<ExprAST> ParseNumberExpr();
- std::unique_ptr<ExprAST> ParseParenExpr();
- std::unique_ptr<ExprAST> ParseIdentifierExpr();
- std::unique_ptr<ExprAST> ParsePrimary();
- std::unique_ptr<ExprAST> ParseBinOpRHS(int ExprPrec, std::unique_ptr<ExprAST> LHS);
- std::unique_ptr<ExprAST> ParseExpression();
- std::unique_ptr<PrototypeAST> ParsePrototype();
- std::unique_ptr<FunctionAST> ParseDefinition();
- std::unique_ptr<FunctionAST> ParseTopLevelExpr();
- std::unique_ptr<PrototypeAST> ParseExtern();
-
- std::unique_ptr<ExprAST> ParseIfExpr();
- std::unique_ptr<ExprAST> ParsePrimary();
-
- std::unique_ptr<ExprAST> ParseForExpr();
- std::unique_ptr<ExprAST> ParseUnary();
- std::unique_ptr<ExprAST> ParseVarExpr();
- std::unique_ptr<ExprAST> ParseConstExpr();
-
-
-void InitializeModuleAndPassManager();
+ ExprAST *ParseNumberExpr();
+ ExprAST *ParseParenExpr();
+ ExprAST *ParseIdentifierExpr();
+ ExprAST *ParsePrimary();
+ ExprAST *ParseBinOpRHS(int ExprPrec, ExprAST *LHS);
+ ExprAST *ParseExpression();
+ PrototypeAST *ParsePrototype(bool isProcedure = false);
+ FunctionAST *ParseDefinition();
+ ExprAST *ParseTopLevelExpr();
+ PrototypeAST *ParseExtern();
+
+ ExprAST *ParseIfExpr();
+ ExprAST *ParsePrimary();
+
+ ExprAST *ParseForExpr();
+ ExprAST *ParseUnary();
+ ExprAST *ParseVarExpr();
+ ExprAST *ParseConstExpr();
+
+
+void InitializeModuleAndPassManager(TargetMachine *TM);
 
  void HandleDefinition();
  void HandleExtern();
@@ -0,0 +1,75 @@
+#include "Remarks.hpp"
+#include "Options.hpp"
+#include "Diagnostics.hpp"
+
+#include <memory>
+
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/LLVMRemarkStreamer.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/ToolOutputFile.h"
+
+using namespace llvm;
+
+static thread_local std::unique_ptr<ToolOutputFile> RemarksOutput;
+
+namespace {
+/// RemarkPrinter - prints the remarks of the passes matching Filter
+struct RemarkPrinter : public DiagnosticHandler {
+  Regex Filter;
+  bool Print; // false with only --remarks-file
+
+  explicit RemarkPrinter(StringRef Pattern) : Filter(Pattern), Print(!Pattern.empty()) {}
+
+  bool isEnabled(StringRef PassName) const { return Print && Filter.match(PassName); }
+  bool isAnalysisRemarkEnabled(StringRef PassName) const override { return isEnabled(PassName); }
+  bool isMissedOptRemarkEnabled(StringRef PassName) const override { return isEnabled(PassName); }
+  bool isPassedOptRemarkEnabled(StringRef PassName) const override { return isEnabled(PassName); }
+  bool isAnyRemarkEnabled() const override { return Print; }
+
+  bool handleDiagnostics(const DiagnosticInfo &DI) override {
+    auto *Remark = dyn_cast<DiagnosticInfoOptimizationBase>(&DI);
+    if (!Remark)
+      return false; // errors and warnings are printed as usual
+    // the remarks file got it already, only the filtered ones are printed
+    if (!isEnabled(Remark->getPassName()))
+      return true;
+
+    StringRef Kind = Remark->isPassed() ? "remark" : Remark->isMissed() ? "missed" : "analysis";
+    diags() << Remark->getLocationStr() << ": " << Kind << ": " << Remark->getMsg()
+           << " [" << Remark->getPassName() << "]\n";
+    return true;
+  }
+};
+} // namespace
+
+bool remarksEnabled() { return !RemarksFilter.empty() || !RemarksFile.empty(); }
+
+bool initializeRemarks(LLVMContext &Ctx, std::string &Error) {
+  if (!remarksEnabled())
+    return true;
+
+  Regex Filter(RemarksFilter);
+  if (!Filter.isValid(Error)) {
+    Error = "invalid --remarks pattern: " + Error;
+    return false;
+  }
+  Ctx.setDiagnosticHandler(std::make_unique<RemarkPrinter>(RemarksFilter));
+
+  if (!RemarksFile.empty()) {
+    // the file gets the same passes, or every pass without --remarks
+    auto File = setupLLVMOptimizationRemarks(Ctx, RemarksFile, RemarksFilter, "yaml",
+                                             /*RemarksWithHotness=*/false);
+    if (!File) {
+      Error = toString(File.takeError());
+      return false;
+    }
+    RemarksOutput = std::move(*File);
+  }
+  return true;
+}
+
+void finishRemarks() {
+  if (RemarksOutput)
+    RemarksOutput->keep();
+}
@@ -0,0 +1,24 @@
+#ifndef PJPPROJECT_REMARKS_HPP
+#define PJPPROJECT_REMARKS_HPP
+
+#include <string>
+
+#include "llvm/IR/LLVMContext.h"
+
+/*
+ * Optimization remarks (vectorized loops, inlined calls, hoisted loads...)
+ * of the passes selected by --remarks, printed to stderr as file:line:col
+ * of the Mila source, and/or written to --remarks-file as YAML.
+ */
+
+/// remarksEnabled - true if --remarks or --remarks-file was given
+bool remarksEnabled();
+
+/// initializeRemarks - route the remarks of Ctx, false with Error set if the
+/// filter is not a valid regex or the file cannot be created
+bool initializeRemarks(llvm::LLVMContext &Ctx, std::string &Error);
+
+/// finishRemarks - keep the remarks file once compilation succeeded
+void finishRemarks();
+
+#endif //PJPPROJECT_REMARKS_HPP
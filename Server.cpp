@@ -0,0 +1,469 @@
+#include "Server.hpp"
+#include "Diagnostics.hpp"
+#include "Options.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+// no request or answer has a longer line (the kind, a file name or a size)
+static const size_t MaxLineLength = 4096;
+
+// a client has this long for every read and write on its connection, one
+// that stalls is dropped instead of keeping its thread forever
+static const int ClientTimeoutSeconds = 30;
+
+// a program run with --run on the server is killed after this long, one
+// that never ends would otherwise keep its thread and its files forever
+static const int RunTimeoutSeconds = 60;
+
+// sources, program input and the outputs that come back are far smaller,
+// a larger block is refused before anything is allocated for it
+static const size_t MaxBlockSize = 64 << 20;
+
+namespace {
+/// Connection - one end of a client connection, owns the socket
+class Connection {
+    int FD;
+    std::string Error; // why the last read failed
+
+public:
+    explicit Connection(int FD) : FD(FD) {}
+    ~Connection() { ::close(FD); }
+
+    /// getError - why the last readLine or readBlock failed
+    const std::string &getError() const { return Error; }
+
+    bool readLine(std::string &Line) {
+        Line.clear();
+        char C;
+        while (true) {
+            ssize_t N = ::read(FD, &C, 1);
+            if (N < 0 && errno == EINTR)
+                continue;
+            if (N <= 0)
+                return failRead(N);
+            if (C == '\n')
+                return true;
+            if (Line.size() == MaxLineLength) {
+                Error = "line longer than " + std::to_string(MaxLineLength) + " bytes";
+                return false;
+            }
+            Line += C;
+        }
+    }
+
+    bool readBlock(std::string &Bytes) {
+        std::string Size;
+        unsigned long long N;
+        if (!readLine(Size))
+            return false;
+        if (getAsUnsignedInteger(Size, 10, N)) {
+            Error = "bad block size '" + Size + "'";
+            return false;
+        }
+        if (N > MaxBlockSize) {
+            Error = "block of " + Size + " bytes, the limit is " + std::to_string(MaxBlockSize);
+            return false;
+        }
+        // grows with what arrives, not with what the size line promises
+        Bytes.clear();
+        char Chunk[1 << 16];
+        while (Bytes.size() < N) {
+            ssize_t R = ::read(FD, Chunk, std::min<size_t>(sizeof(Chunk), N - Bytes.size()));
+            if (R < 0 && errno == EINTR)
+                continue;
+            if (R <= 0)
+                return failRead(R);
+            Bytes.append(Chunk, R);
+        }
+        return true;
+    }
+
+    bool write(StringRef Bytes) {
+        // a client that went away must not take the server down with SIGPIPE
+        for (size_t Done = 0; Done < Bytes.size();) {
+            ssize_t W = ::send(FD, Bytes.data() + Done, Bytes.size() - Done, MSG_NOSIGNAL);
+            if (W < 0 && errno == EINTR)
+                continue;
+            if (W < 0)
+                return false;
+            Done += W;
+        }
+        return true;
+    }
+
+    bool writeLine(StringRef Line) { return write(Line) && write("\n"); }
+
+    bool writeBlock(StringRef Bytes) {
+        return writeLine(std::to_string(Bytes.size())) && write(Bytes);
+    }
+
+private:
+    bool failRead(ssize_t N) {
+        if (N == 0)
+            Error = "connection closed";
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            Error = "nothing received for " + std::to_string(ClientTimeoutSeconds) + " seconds";
+        else
+            Error = strerror(errno);
+        return false;
+    }
+};
+
+/// CompileSlots - at most Size requests compile at once; a client that is
+/// still sending its request or a program run for one does not hold a slot
+class CompileSlots {
+    std::mutex Lock;
+    std::condition_variable Freed;
+    unsigned Free;
+
+public:
+    explicit CompileSlots(unsigned Size) : Free(Size) {}
+
+    void acquire() {
+        std::unique_lock<std::mutex> Guard(Lock);
+        Freed.wait(Guard, [this] { return Free > 0; });
+        --Free;
+    }
+
+    void release() {
+        {
+            std::lock_guard<std::mutex> Guard(Lock);
+            ++Free;
+        }
+        Freed.notify_one();
+    }
+};
+} // namespace
+
+/// fillAddress - Addr for the socket at Path, false if the path is too long
+static bool fillAddress(StringRef Path, sockaddr_un &Addr) {
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    if (Path.size() >= sizeof(Addr.sun_path)) {
+        errs() << "error: socket path too long: " << Path << "\n";
+        return false;
+    }
+    memcpy(Addr.sun_path, Path.data(), Path.size());
+    return true;
+}
+
+// connections are answered on threads of their own, the warnings of
+// several must not interleave
+static std::mutex WarnLock;
+
+static void warn(const Twine &Msg) {
+    int Errno = errno;
+    std::lock_guard<std::mutex> Guard(WarnLock);
+    errs() << "warning: serve: " << Msg << ": " << strerror(Errno) << "\n";
+}
+
+/// readFile - the whole file at Path into Bytes
+static bool readFile(StringRef Path, std::string &Bytes) {
+    auto Buffer = MemoryBuffer::getFile(Path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+    if (!Buffer)
+        return false;
+    Bytes = (*Buffer)->getBuffer().str();
+    return true;
+}
+
+/// writeFile - Bytes to a new file at Path
+static bool writeFile(StringRef Path, StringRef Bytes, std::string &Error) {
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+    if (EC) {
+        Error = "cannot write " + Path.str() + ": " + EC.message();
+        return false;
+    }
+    OS << Bytes;
+    return true;
+}
+
+/// runProgram - run the executable Exe with Input as its standard input,
+/// Output gets what it prints, Log what it reports; its exit code
+static int runProgram(StringRef Dir, StringRef Exe, StringRef Input, std::string &Output,
+                      raw_ostream &Log) {
+    SmallString<128> In(Dir), Out(Dir), Err(Dir);
+    sys::path::append(In, "stdin");
+    sys::path::append(Out, "stdout");
+    sys::path::append(Err, "stderr");
+
+    std::string Error;
+    if (!writeFile(In, Input, Error)) {
+        Log << "error: " << Error << "\n";
+        return 1;
+    }
+    Optional<StringRef> Redirects[] = { StringRef(In), StringRef(Out), StringRef(Err) };
+    StringRef Args[] = { Exe };
+    // ExecuteAndWait would time out with alarm(), which is process wide and
+    // not to be shared by the threads of the server, so the child is polled
+    bool ExecutionFailed;
+    sys::ProcessInfo PI = sys::ExecuteNoWait(Exe, Args, None, Redirects, 0, &Error,
+                                             &ExecutionFailed);
+    int RC = -1;
+    if (!ExecutionFailed) {
+        auto Deadline = std::chrono::steady_clock::now() + std::chrono::seconds(RunTimeoutSeconds);
+        sys::ProcessInfo Result;
+        while ((Result = sys::Wait(PI, 0, false, &Error)).Pid == 0 &&
+               std::chrono::steady_clock::now() < Deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (Result.Pid == 0) {
+            ::kill(PI.Pid, SIGKILL);
+            sys::Wait(PI, 0, true);
+            Error = "it did not finish within " + std::to_string(RunTimeoutSeconds) +
+                    " seconds and was killed";
+        } else {
+            RC = Result.ReturnCode;
+        }
+    }
+    if (RC < 0)
+        Log << "error: cannot run the program: " << Error << "\n";
+
+    std::string Printed;
+    readFile(Out, Output);
+    if (readFile(Err, Printed))
+        Log << Printed;
+    return RC < 0 ? 1 : RC;
+}
+
+/// reply - the answer to a request: exit code, messages and output
+static void reply(Connection &C, int RC, StringRef Log, StringRef Output) {
+    if (!C.writeLine(std::to_string(RC)) || !C.writeBlock(Log) || !C.writeBlock(Output))
+        warn("cannot answer a client");
+}
+
+/// answer - compile one request of C with the options of the server and
+/// the output kind of the request, once Slots has room for it
+static void answer(Connection &C, CompileFn Compile, CompileSlots &Slots) {
+    std::string Kind, Name, Source, Input;
+    if (!C.readLine(Kind)) {
+        if (!Kind.empty() || C.getError() != "connection closed")
+            reply(C, 1, "error: bad request: " + C.getError() + "\n", "");
+        return; // a client that connected and went away needs no answer
+    }
+    if (!C.readLine(Name) || !C.readBlock(Source) || !C.readBlock(Input)) {
+        reply(C, 1, "error: bad request: " + C.getError() + "\n", "");
+        return;
+    }
+
+    std::string Log, Output;
+    raw_string_ostream LogOS(Log);
+    int RC = 1;
+
+    // the source keeps its file name, messages point at it as usual
+    SmallString<128> Dir, SourcePath, OutputPath;
+    if (auto EC = sys::fs::createUniqueDirectory("mila-serve", Dir)) {
+        LogOS << "error: cannot create a directory for the request: " << EC.message() << "\n";
+    } else {
+        StringRef File = sys::path::filename(Name);
+        SourcePath = Dir;
+        sys::path::append(SourcePath, File.empty() ? "input.mila" : File);
+        OutputPath = Dir;
+        sys::path::append(OutputPath, Kind == "ir" ? "output.ll" : "output");
+
+        std::string Error;
+        if (Kind != "object" && Kind != "executable" && Kind != "ir" && Kind != "run") {
+            LogOS << "error: unknown request '" << Kind << "'\n";
+        } else if (!writeFile(SourcePath, Source, Error)) {
+            LogOS << "error: " << Error << "\n";
+        } else {
+            UnitOptions Opts;
+            Opts.CompileOnly = Kind == "object";
+            Opts.EmitLLVM = Kind == "ir";
+
+            Slots.acquire();
+            setUnitOptions(&Opts);
+            setDiagnosticStream(&LogOS);
+            RC = Compile(SourcePath, OutputPath);
+            setDiagnosticStream(nullptr);
+            setUnitOptions(nullptr);
+            Slots.release();
+
+            if (RC == 0 && Kind == "run")
+                RC = runProgram(Dir, OutputPath, Input, Output, LogOS);
+            else if (RC == 0 && !readFile(OutputPath, Output))
+                RC = 1;
+        }
+        sys::fs::remove_directories(Dir);
+    }
+
+    LogOS.flush();
+    reply(C, RC, Log, Output);
+}
+
+/// checkServeOptions - the options that name one output of one compilation
+static bool checkServeOptions() {
+    const char *Conflict = !OutputFilename.empty()   ? "-o"
+                         : RunProgram                ? "--run"
+                         : Batch                     ? "--batch"
+                         : !RemarksFile.empty()      ? "--remarks-file"
+                         : !InputFilenames.empty()   ? "an input file"
+                         : nullptr;
+    if (Conflict) {
+        errs() << "error: " << Conflict << " cannot be used with --serve\n";
+        return false;
+    }
+    return true;
+}
+
+/// removeStaleSocket - make room for the socket at Addr: only the socket of
+/// a server that did not exit cleanly is removed, false (reported) if
+/// anything else is there, a live server included
+static bool removeStaleSocket(const sockaddr_un &Addr) {
+    struct stat Status;
+    if (::lstat(Addr.sun_path, &Status) < 0) {
+        if (errno == ENOENT)
+            return true;
+        errs() << "error: cannot check " << Addr.sun_path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    if (!S_ISSOCK(Status.st_mode)) {
+        errs() << "error: " << Addr.sun_path << " exists and is not a socket\n";
+        return false;
+    }
+
+    // nobody listens on a stale socket, connecting to it is refused
+    int Probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Probe < 0) {
+        errs() << "error: cannot create a socket: " << strerror(errno) << "\n";
+        return false;
+    }
+    int RC = ::connect(Probe, (const sockaddr *) &Addr, sizeof(Addr));
+    int Errno = errno;
+    ::close(Probe);
+    if (RC == 0) {
+        errs() << "error: a server is already running on " << Addr.sun_path << "\n";
+        return false;
+    }
+    if (Errno != ECONNREFUSED) {
+        errs() << "error: cannot check " << Addr.sun_path << ": " << strerror(Errno) << "\n";
+        return false;
+    }
+    if (::unlink(Addr.sun_path) < 0 && errno != ENOENT) {
+        errs() << "error: cannot remove " << Addr.sun_path << ": " << strerror(errno) << "\n";
+        return false;
+    }
+    return true;
+}
+
+int serve(StringRef SocketPath, CompileFn Compile) {
+    sockaddr_un Addr;
+    if (!checkServeOptions() || !fillAddress(SocketPath, Addr))
+        return 1;
+
+    int Listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Listener < 0) {
+        errs() << "error: cannot create a socket: " << strerror(errno) << "\n";
+        return 1;
+    }
+    if (!removeStaleSocket(Addr)) {
+        ::close(Listener);
+        return 1;
+    }
+    if (::bind(Listener, (sockaddr *) &Addr, sizeof(Addr)) < 0 || ::listen(Listener, SOMAXCONN) < 0) {
+        errs() << "error: cannot listen on " << SocketPath << ": " << strerror(errno) << "\n";
+        ::close(Listener);
+        return 1;
+    }
+    errs() << "mila: serving on " << SocketPath << "\n";
+
+    // every connection gets a thread, the compiler state is thread_local;
+    // the compilations themselves share the cores
+    CompileSlots Slots(heavyweight_hardware_concurrency().compute_thread_count());
+    timeval Timeout = { ClientTimeoutSeconds, 0 };
+    while (true) {
+        int FD = ::accept(Listener, nullptr, nullptr);
+        if (FD < 0) {
+            if (errno != EINTR && errno != ECONNABORTED)
+                warn("accept failed");
+            continue;
+        }
+        if (::setsockopt(FD, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout)) < 0 ||
+            ::setsockopt(FD, SOL_SOCKET, SO_SNDTIMEO, &Timeout, sizeof(Timeout)) < 0)
+            warn("cannot set the timeouts of a client");
+        std::thread([FD, Compile, &Slots] {
+            Connection C(FD);
+            answer(C, Compile, Slots);
+        }).detach();
+    }
+}
+
+int compileOnServer(StringRef SocketPath, StringRef Input, StringRef Output) {
+    sockaddr_un Addr;
+    if (!fillAddress(SocketPath, Addr))
+        return 1;
+
+    auto Source = MemoryBuffer::getFileOrSTDIN(Input);
+    if (!Source) {
+        errs() << "error: cannot read " << Input << ": " << Source.getError().message() << "\n";
+        return 1;
+    }
+    // a program run by the server reads what we were given, all of it upfront
+    std::string ProgramInput;
+    if (RunProgram && Input != "-") {
+        if (auto Stdin = MemoryBuffer::getSTDIN())
+            ProgramInput = (*Stdin)->getBuffer().str();
+    }
+
+    int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0 || ::connect(FD, (sockaddr *) &Addr, sizeof(Addr)) < 0) {
+        errs() << "error: cannot connect to " << SocketPath << ": " << strerror(errno) << "\n";
+        if (FD >= 0)
+            ::close(FD);
+        return 1;
+    }
+    Connection C(FD);
+
+    StringRef Kind = RunProgram ? "run" : EmitLLVM ? "ir" : CompileOnly ? "object" : "executable";
+    std::string Status, Log, Bytes;
+    unsigned long long RC;
+    if (!C.writeLine(Kind) || !C.writeLine(Input == "-" ? "stdin.mila" : Input) ||
+        !C.writeBlock((*Source)->getBuffer()) || !C.writeBlock(ProgramInput) ||
+        !C.readLine(Status) || getAsUnsignedInteger(Status, 10, RC) || !C.readBlock(Log) ||
+        !C.readBlock(Bytes)) {
+        errs() << "error: the server on " << SocketPath << " did not answer\n";
+        return 1;
+    }
+
+    errs() << Log;
+    if (RunProgram) {
+        outs() << Bytes;
+        return RC;
+    }
+    if (RC != 0)
+        return RC;
+
+    std::string Error;
+    if (!writeFile(Output, Bytes, Error)) {
+        errs() << "error: " << Error << "\n";
+        return 1;
+    }
+    // an executable has to be one on this side too
+    if (Kind == "executable")
+        sys::fs::setPermissions(Output, sys::fs::owner_all | sys::fs::group_read | sys::fs::group_exe |
+                                            sys::fs::others_read | sys::fs::others_exe);
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef PJPPROJECT_SERVER_HPP
+#define PJPPROJECT_SERVER_HPP
+
+#include "Batch.hpp"
+
+#include "llvm/ADT/StringRef.h"
+
+/*
+ * Compile server. mila --serve=<socket> initializes the targets once and
+ * then compiles the sources that mila --connect=<socket> clients send over
+ * the Unix socket, with the options the server was started with. Every
+ * connection is answered on a thread of its own, as many compile at once
+ * as there are cores, and a client that sends nothing for a while is
+ * dropped. A request asks for an object file (-c), an executable, the
+ * optimized IR (--emit-llvm) or the output of running the program (--run);
+ * messages come back as if the client had compiled the source itself.
+ *
+ * Both sides speak the same framing: a request is the kind and the source
+ * file name on a line each, then the source and the standard input of a
+ * run as blocks; the answer is the exit code on a line, then the messages
+ * and the output as blocks. A block is its size on a line, then the bytes.
+ * A request that breaks the framing is answered with an error.
+ */
+
+/// serve - answer requests on SocketPath with Compile until killed,
+/// returns 1 if the socket cannot be set up
+int serve(llvm::StringRef SocketPath, CompileFn Compile);
+
+/// compileOnServer - send Input to the server on SocketPath, write what
+/// comes back to Output (stdout for --run), returns the exit code
+int compileOnServer(llvm::StringRef SocketPath, llvm::StringRef Input, llvm::StringRef Output);
+
+#endif //PJPPROJECT_SERVER_HPP
@@ -0,0 +1,11 @@
+#include "SourceBuffer.hpp"
+
+std::unique_ptr<SourceBuffer> SourceBuffer::open(const std::string & Path, std::string & Error) {
+    // getFileOrSTDIN mmaps regular files and slurps stdin in one go.
+    auto BufOrErr = llvm::MemoryBuffer::getFileOrSTDIN(Path);
+    if (std::error_code EC = BufOrErr.getError()) {
+        Error = Path + ": " + EC.message();
+        return nullptr;
+    }
+    return std::unique_ptr<SourceBuffer>(new SourceBuffer(std::move(*BufOrErr)));
+}
@@ -0,0 +1,36 @@
+#ifndef PJPPROJECT_SOURCEBUFFER_HPP
+#define PJPPROJECT_SOURCEBUFFER_HPP
+
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+/*
+ * SourceBuffer owns the complete text of one Mila source.
+ * A named file is memory-mapped (for anything larger than a few pages),
+ * "-" reads the whole standard input once. The lexer then scans the
+ * contiguous range [begin(), end()) without going through stdio.
+ */
+class SourceBuffer {
+public:
+    /// open - Load the file at Path ("-" for stdin). Returns nullptr and fills
+    /// Error if the source cannot be read.
+    static std::unique_ptr<SourceBuffer> open(const std::string & Path, std::string & Error);
+
+    const char * begin() const { return Buffer->getBufferStart(); }
+    const char * end() const   { return Buffer->getBufferEnd(); }
+    size_t size() const        { return Buffer->getBufferSize(); }
+
+    /// getName - file name used in diagnostics ("<stdin>" for standard input).
+    llvm::StringRef getName() const { return Buffer->getBufferIdentifier(); }
+
+private:
+    explicit SourceBuffer(std::unique_ptr<llvm::MemoryBuffer> Buffer)
+        : Buffer(std::move(Buffer)) {}
+
+    std::unique_ptr<llvm::MemoryBuffer> Buffer;
+};
+
+#endif //PJPPROJECT_SOURCEBUFFER_HPP
@@ -0,0 +1,24 @@
+#include "Symbol.hpp"
+
+thread_local SymbolTable Symbols;
+
+SymbolTable::SymbolTable() {
+    clear();
+}
+
+void SymbolTable::clear() {
+    Ids.clear();
+    Names.clear();
+    // must match the order of BuiltinSymbol
+    intern("");
+    intern("main");
+    intern("readln");
+    intern("writeln");
+}
+
+Symbol SymbolTable::intern(std::string_view Name) {
+    auto Res = Ids.try_emplace(llvm::StringRef(Name.data(), Name.size()), (Symbol) Names.size());
+    if (Res.second)
+        Names.push_back(Res.first->getKey());
+    return Res.first->getValue();
+}
@@ -0,0 +1,47 @@
+#ifndef PJPPROJECT_SYMBOL_HPP
+#define PJPPROJECT_SYMBOL_HPP
+
+#include <string_view>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+/// Symbol - an interned identifier. Two identifiers with the same spelling get
+/// the same Symbol, so symbol tables can hash and compare plain integers.
+using Symbol = unsigned;
+
+/// Symbols that exist in every table, in this order.
+enum BuiltinSymbol : Symbol {
+    Sym_None = 0,   // the empty name, "no symbol"
+    Sym_main,
+    Sym_readln,
+    Sym_writeln,
+};
+
+/*
+ * SymbolTable maps identifier spellings to Symbols and back.
+ * Each spelling is copied once, when it is first interned.
+ */
+class SymbolTable {
+public:
+    SymbolTable();
+
+    /// intern - return the Symbol for Name, creating it on first use
+    Symbol intern(std::string_view Name);
+
+    /// str - spelling of an interned symbol
+    llvm::StringRef str(Symbol S) const { return Names[S]; }
+
+    /// clear - forget every symbol but the built-in ones, so that a thread
+    /// compiling one unit after another does not keep the names of all of them
+    void clear();
+
+private:
+    llvm::StringMap<Symbol> Ids;        // owns the characters
+    std::vector<llvm::StringRef> Names; // Symbol -> key stored in Ids
+};
+
+extern thread_local SymbolTable Symbols;
+
+#endif //PJPPROJECT_SYMBOL_HPP
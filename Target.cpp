@@ -0,0 +1,148 @@
+#include "Target.hpp"
+#include "Optimizer.hpp"
+#include "Options.hpp"
+
+#include <memory>
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/MC/MCSubtargetInfo.h"
+#include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+using namespace llvm;
+
+/// resolveCPU - "native" is the CPU we are running on
+static std::string resolveCPU(const std::string &Name) {
+    if (Name == "native")
+        return sys::getHostCPUName().str();
+    return Name;
+}
+
+/// getFeatures - host features for -mcpu=native, then -mattr on top of them
+static std::string getFeatures() {
+    SubtargetFeatures Features;
+
+    StringMap<bool> HostFeatures;
+    if (MCPU == "native" && sys::getHostCPUFeatures(HostFeatures))
+        for (auto &F : HostFeatures)
+            Features.AddFeature(F.first(), F.second);
+
+    for (auto &Attr : MAttrs)
+        Features.AddFeature(Attr);
+
+    return Features.getString();
+}
+
+TargetMachine *createHostTargetMachine(std::string &Error) {
+    auto TargetTriple = sys::getDefaultTargetTriple();
+
+    // Print an error and exit if we couldn't find the requested target.
+    // This generally occurs if we've forgotten to initialise the
+    // TargetRegistry or we have a bogus target triple.
+    auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
+    if (!Target)
+        return nullptr;
+
+    std::string CPU = resolveCPU(MCPU);
+    std::string Features = getFeatures();
+
+    // unknown names would only be reported as a warning and then ignored
+    std::unique_ptr<MCSubtargetInfo> STI(
+        Target->createMCSubtargetInfo(TargetTriple, "", ""));
+    for (auto &Name : { CPU, resolveCPU(MTune) }) {
+        if (!Name.empty() && !STI->isCPUStringValid(Name)) {
+            Error = "'" + Name + "' is not a recognized processor for " + TargetTriple;
+            return nullptr;
+        }
+    }
+
+    TargetOptions opt;
+    // programs are linked by the host C compiler, which produces PIEs
+    auto RM = Optional<Reloc::Model>(Reloc::PIC_);
+    auto TM = Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM, None,
+                                          getCodeGenOptLevel());
+    return TM;
+}
+
+void applyTargetAttributes(Function &F) {
+    if (!MTune.empty())
+        F.addFnAttr("tune-cpu", resolveCPU(MTune));
+}
+
+bool emitObjectFile(Module &M, TargetMachine &TM, StringRef Path, std::string &Error) {
+    std::error_code EC;
+    raw_fd_ostream dest(Path, EC, sys::fs::OF_None);
+
+    if (EC) {
+        Error = "Could not open file: " + EC.message();
+        return false;
+    }
+
+    legacy::PassManager pass;
+    auto FileType = CGFT_ObjectFile;
+
+    if (TM.addPassesToEmitFile(pass, dest, nullptr, FileType)) {
+        Error = "TheTargetMachine can't emit a file of this type";
+        return false;
+    }
+
+    pass.run(M);
+    dest.close();
+    return true;
+}
+
+bool emitSplitObjectFiles(Module &M, ArrayRef<std::string> Paths, std::string &Error) {
+    // a context may only be used by one thread at a time, so every partition
+    // is handed over as bitcode and read back into a context of its own
+    std::vector<SmallString<0>> Partitions;
+    SplitModule(M, Paths.size(), [&](std::unique_ptr<Module> Part) {
+        Partitions.emplace_back();
+        raw_svector_ostream OS(Partitions.back());
+        WriteBitcodeToFile(*Part, OS);
+    }, /*PreserveLocals=*/false);
+
+    // target machines keep state while they emit code, one per thread
+    std::vector<std::unique_ptr<TargetMachine>> Machines;
+    for (size_t I = 0; I < Partitions.size(); ++I) {
+        Machines.emplace_back(createHostTargetMachine(Error));
+        if (!Machines.back())
+            return false;
+    }
+
+    std::vector<std::string> Errors(Partitions.size());
+    ThreadPool Pool(heavyweight_hardware_concurrency(Partitions.size()));
+    for (size_t I = 0; I < Partitions.size(); ++I) {
+        Pool.async([&, I] {
+            LLVMContext Context;
+            std::string Name = "partition" + std::to_string(I);
+            MemoryBufferRef Buffer(StringRef(Partitions[I].data(), Partitions[I].size()), Name);
+            auto Part = parseBitcodeFile(Buffer, Context);
+            if (!Part) {
+                Errors[I] = toString(Part.takeError());
+                return;
+            }
+            emitObjectFile(**Part, *Machines[I], Paths[I], Errors[I]);
+        });
+    }
+    Pool.wait();
+
+    // reported in partition order, whichever thread failed first
+    for (std::string &E : Errors) {
+        if (!E.empty()) {
+            Error = E;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,35 @@
+#ifndef PJPPROJECT_TARGET_HPP
+#define PJPPROJECT_TARGET_HPP
+
+#include <string>
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+
+/*
+ * Target selection. The CPU and its features come from -mcpu/-march and
+ * -mattr, "native" asks the host for both; -mtune only changes scheduling
+ * and cost decisions, it is recorded on every function.
+ */
+
+/// createHostTargetMachine - target machine for the default triple and the
+/// requested CPU, null with Error set if the target or CPU is unknown
+llvm::TargetMachine *createHostTargetMachine(std::string &Error);
+
+/// applyTargetAttributes - attach the -mtune CPU to a freshly created function
+void applyTargetAttributes(llvm::Function &F);
+
+/// emitObjectFile - write M as an object file to Path, false with Error set
+/// if the file cannot be written
+bool emitObjectFile(llvm::Module &M, llvm::TargetMachine &TM, llvm::StringRef Path,
+                    std::string &Error);
+
+/// emitSplitObjectFiles - split M into one partition per path and compile
+/// them in parallel, each on a context and target machine of its own
+bool emitSplitObjectFiles(llvm::Module &M, llvm::ArrayRef<std::string> Paths,
+                          std::string &Error);
+
+#endif //PJPPROJECT_TARGET_HPP
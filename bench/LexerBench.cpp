@@ -0,0 +1,186 @@
+#include "../Lexer.hpp"
+#include "../SourceBuffer.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+/*
+ * Lexer micro-benchmark. A synthetic Mila source (one program with a
+ * function, a procedure, loops, arrays and constants, repeated) is written
+ * to a temporary file and lexed through the real Lexer. The identifiers it
+ * contains are then classified again with keywordToken() and with the
+ * chain of std::string comparisons gettok() used before, so the two
+ * keyword paths are compared on the same input.
+ *
+ *   lexer-bench [copies] [runs]     (default 20000 copies, best of 5 runs)
+ */
+
+using namespace llvm;
+
+static const char Unit[] =
+    "const N = 100; Limit = $FF; Mask = &777;\n"
+    "var I, J, Sum, Count : integer;\n"
+    "var Values : array [0 .. 99] of integer;\n"
+    "function gcd(A : integer; B : integer) : integer;\n"
+    "begin\n"
+    "  while B <> 0 do begin\n"
+    "    Count := A mod B; A := B; B := Count;\n"
+    "  end;\n"
+    "  gcd := A;\n"
+    "end;\n"
+    "procedure fill(Start : integer); forward;\n"
+    "procedure fill(Start : integer);\n"
+    "var K : integer;\n"
+    "begin\n"
+    "  for K := 0 to N - 1 do Values[K] := Start + K * 3;\n"
+    "  for K := N - 1 downto 1 do\n"
+    "    if (Values[K] >= Limit) and not (K = 0) then Values[K] := Values[K] div 2\n"
+    "    else Values[K] := (Values[K] xor Mask) or 1;\n"
+    "end;\n"
+    "# comments are skipped by the lexer\n";
+
+/// oldKeywordToken - the keyword chain gettok() ran on a copied identifier
+/// before keywordToken(), with the keywords added since at its end
+static int oldKeywordToken(const std::string & Id) {
+    if (Id == "function")  return tok_function;
+    if (Id == "program")   return tok_program;
+    if (Id == "begin")     return tok_begin;
+    if (Id == "end")       return tok_end;
+    if (Id == "integer")   return tok_integer;
+    if (Id == "exit")      return tok_exit;
+    if (Id == "forward")   return tok_forward;
+    if (Id == "if")        return tok_if;
+    if (Id == "then")      return tok_then;
+    if (Id == "else")      return tok_else;
+    if (Id == "for")       return tok_for;
+    if (Id == "to")        return tok_to;
+    if (Id == "do")        return tok_do;
+    if (Id == "var")       return tok_var;
+    if (Id == "const")     return tok_const;
+    if (Id == "downto")    return tok_downto;
+    if (Id == "procedure") return tok_procedure;
+    if (Id == "while")     return tok_while;
+    if (Id == "mod")       return tok_mod;
+    if (Id == "div")       return tok_div;
+    if (Id == "not")       return tok_not;
+    if (Id == "and")       return tok_and;
+    if (Id == "or")        return tok_or;
+    if (Id == "xor")       return tok_xor;
+    if (Id == "array")     return tok_array;
+    if (Id == "of")        return tok_of;
+    if (Id == "readln")    return tok_readln;
+    if (Id == "writeln")   return tok_writeln;
+    return tok_identifier;
+}
+
+/// bestOf - shortest of Runs calls of Fn, in seconds
+template <typename Fn>
+static double bestOf(unsigned Runs, Fn F) {
+    double Best = 1e30;
+    for (unsigned R = 0; R < Runs; ++R) {
+        auto Start = std::chrono::steady_clock::now();
+        F();
+        std::chrono::duration<double> Took = std::chrono::steady_clock::now() - Start;
+        if (Took.count() < Best)
+            Best = Took.count();
+    }
+    return Best;
+}
+
+int main(int argc, char *argv[]) {
+    unsigned Copies = argc > 1 ? (unsigned) atoi(argv[1]) : 20000;
+    unsigned Runs = argc > 2 ? (unsigned) atoi(argv[2]) : 5;
+    if (Copies == 0 || Runs == 0) {
+        errs() << "usage: lexer-bench [copies] [runs]\n";
+        return 1;
+    }
+
+    SmallString<128> Path;
+    if (auto EC = sys::fs::createTemporaryFile("lexer-bench", "mila", Path)) {
+        errs() << "error: cannot create a temporary file: " << EC.message() << "\n";
+        return 1;
+    }
+    FileRemover Remover(Path);
+    {
+        std::error_code EC;
+        raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+        if (EC) {
+            errs() << "error: cannot write " << Path << ": " << EC.message() << "\n";
+            return 1;
+        }
+        OS << "program bench;\n";
+        for (unsigned I = 0; I < Copies; ++I)
+            OS << Unit;
+        OS << "begin\nend.\n";
+    }
+
+    std::string Error;
+    auto Source = SourceBuffer::open(std::string(Path), Error);
+    if (!Source) {
+        errs() << "error: " << Error << "\n";
+        return 1;
+    }
+
+    // the identifiers (keywords included) of the source, as the lexer saw them
+    std::vector<std::string> Identifiers;
+    size_t Tokens = 0;
+    {
+        Lexer L(*Source);
+        for (TokenInfo Tok = L.next(); Tok.Kind != tok_eof; Tok = L.next()) {
+            ++Tokens;
+            if (!Tok.Text.empty() && isalpha((unsigned char) Tok.Text[0]))
+                Identifiers.emplace_back(Tok.Text);
+        }
+    }
+    for (const std::string &Id : Identifiers) {
+        if (keywordToken(Id.data(), Id.size()) != oldKeywordToken(Id)) {
+            errs() << "error: the keyword paths disagree on '" << Id << "'\n";
+            return 1;
+        }
+    }
+
+    // the sums keep the compiler from dropping the loops
+    volatile long Sink = 0;
+    double Lex = bestOf(Runs, [&] {
+        Lexer L(*Source);
+        long Sum = 0;
+        for (TokenInfo Tok = L.next(); Tok.Kind != tok_eof; Tok = L.next())
+            Sum += Tok.Kind;
+        Sink = Sink + Sum;
+    });
+    double Switch = bestOf(Runs, [&] {
+        long Sum = 0;
+        for (const std::string &Id : Identifiers)
+            Sum += keywordToken(Id.data(), Id.size());
+        Sink = Sink + Sum;
+    });
+    // gettok() copied every identifier into a std::string before the chain
+    double Chain = bestOf(Runs, [&] {
+        long Sum = 0;
+        std::string Copy;
+        for (const std::string &Id : Identifiers) {
+            Copy.assign(Id.data(), Id.size());
+            Sum += oldKeywordToken(Copy);
+        }
+        Sink = Sink + Sum;
+    });
+
+    // the lexer with the chain in place of the switch, everything else equal
+    double LexChain = Lex - Switch + Chain;
+    outs() << "source:          " << Source->size() << " bytes, " << Tokens << " tokens, "
+           << Identifiers.size() << " identifiers and keywords\n";
+    outs() << format("keyword switch:  %8.1f M identifiers/s\n", Identifiers.size() / Switch / 1e6);
+    outs() << format("string chain:    %8.1f M identifiers/s\n", Identifiers.size() / Chain / 1e6);
+    outs() << format("lexer, switch:   %8.1f M tokens/s\n", Tokens / Lex / 1e6);
+    outs() << format("lexer, chain:    %8.1f M tokens/s (estimated)\n", Tokens / LexChain / 1e6);
+    return 0;
+}
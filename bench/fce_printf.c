@@ -0,0 +1,30 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * fce.c as it was before output was buffered: one printf call per number.
+ * runtime-bench.sh links bench programs against it to compare with fce.c.
+ */
+
+int writeln(int x) {
+    printf("%d\n", x);
+    return 0;
+}
+int write(int x) {
+    printf("%d", x);
+    return 0;
+}
+int readln(int *x) {
+    return scanf("%d", x);
+}
+int readlnArray(int *a, int n) {
+    int i = 0;
+    while (i < n && scanf("%d", a + i) == 1)
+        i++;
+    return i;
+}
+void milaBoundsError(int index, int lo, int hi) {
+    fflush(stdout);
+    fprintf(stderr, "error: index %d out of bounds [%d .. %d]\n", index, lo, hi);
+    exit(1);
+}
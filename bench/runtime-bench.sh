@@ -0,0 +1,39 @@
+#!/bin/bash
+# Output benchmark of the runtime: bench/writeInts.mila, compiled once, is
+# linked against fce.c and against the printf runtime it replaced, then
+# both write 10^7 integers to a file and to a pipe, three times each.
+#
+#   runtime-bench.sh <mila> <cc> <runtime archive>
+
+if [ $# -ne 3 ]; then
+    echo "usage: $0 <mila> <cc> <runtime archive>" >&2
+    exit 1
+fi
+MILA=$1
+CC=$2
+RUNTIME=$3
+BENCH=$(cd "$(dirname "$0")" && pwd)
+
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+
+"$MILA" -c -o "$WORK/writeInts.o" "$BENCH/writeInts.mila" 2> /dev/null || exit 1
+"$CC" -O2 "$WORK/writeInts.o" "$BENCH/fce_printf.c" -o "$WORK/printf" || exit 1
+"$CC" "$WORK/writeInts.o" "$RUNTIME" -o "$WORK/fce" || exit 1
+
+"$WORK/printf" > "$WORK/printf.txt"
+"$WORK/fce" > "$WORK/fce.txt"
+if ! cmp -s "$WORK/printf.txt" "$WORK/fce.txt"; then
+    echo "the two runtimes print different output" >&2
+    exit 1
+fi
+rm -f "$WORK/printf.txt" "$WORK/fce.txt"
+
+TIMEFORMAT=%R
+for RUN in 1 2 3; do
+    for NAME in printf fce; do
+        FILE=$( { time "$WORK/$NAME" > "$WORK/out.txt"; } 2>&1 )
+        PIPE=$( { time "$WORK/$NAME" | cat > /dev/null; } 2>&1 )
+        echo "run $RUN, $NAME runtime: file ${FILE}s, pipe ${PIPE}s"
+    done
+done
@@ -1,13 +1,258 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+ * The compiler links this file in as well, --run binds the programs it
+ * executes in memory to the same functions. There they get names of their
+ * own (MILA_JIT_RUNTIME), a write() of ours would replace the one of libc
+ * in the whole compiler.
+ */
+#ifdef MILA_JIT_RUNTIME
+#define writeln milaJITWriteln
+#define write milaJITWrite
+#define readln milaJITReadln
+#define readlnArray milaJITReadlnArray
+#define milaBoundsError milaJITBoundsError
+#endif
+
+/*
+ * Output goes through one static buffer instead of a printf call per
+ * number. It is written out when it fills up, before readln waits for
+ * input and when the program exits.
+ */
+
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+
+/* longest line: "-2147483648\n" */
+#define MAX_INT_LENGTH 12
+
+static char OutputBuffer[OUTPUT_BUFFER_SIZE];
+static size_t OutputLength;
+static int FlushAtExit;
+
+static const char DigitPairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void flushOutput(void) {
+    if (OutputLength) {
+        fwrite(OutputBuffer, 1, OutputLength, stdout);
+        fflush(stdout);
+        OutputLength = 0;
+    }
+}
+
+/* formats x backwards so that it ends right before End, returns its start */
+static char *formatInt(char *End, int x) {
+    unsigned u = x < 0 ? 0u - (unsigned) x : (unsigned) x;
+    char *p = End;
+    while (u >= 100) {
+        unsigned r = u % 100;
+        u /= 100;
+        p -= 2;
+        memcpy(p, DigitPairs + 2 * r, 2);
+    }
+    if (u >= 10) {
+        p -= 2;
+        memcpy(p, DigitPairs + 2 * u, 2);
+    } else {
+        *--p = (char) ('0' + u);
+    }
+    if (x < 0)
+        *--p = '-';
+    return p;
+}
+
+static void putInt(int x, int newline) {
+    char Digits[MAX_INT_LENGTH];
+    char *End = Digits + sizeof(Digits);
+    char *Begin;
+
+    if (newline)
+        End[-1] = '\n';
+    Begin = formatInt(End - newline, x);
+
+    if (!FlushAtExit) {
+        atexit(flushOutput);
+        FlushAtExit = 1;
+    }
+    if (OutputLength + MAX_INT_LENGTH > OUTPUT_BUFFER_SIZE)
+        flushOutput();
+    memcpy(OutputBuffer + OutputLength, Begin, (size_t) (End - Begin));
+    OutputLength += (size_t) (End - Begin);
+}
+
+/*
+ * Input is read in large blocks straight from the file descriptor and
+ * numbers are parsed from the buffer, up to eight digits at once.
+ * A number is only parsed once it is followed by whitespace or the end of
+ * input, so one cut by the end of the buffer is completed by the next block.
+ */
+
+#define INPUT_BUFFER_SIZE (1 << 16)
+
+/* zero bytes after the data, eight digits are loaded at once */
+#define INPUT_PADDING 8
+
+static char InputBuffer[INPUT_BUFFER_SIZE + INPUT_PADDING];
+static size_t InputPos, InputEnd;
+static int InputEOF;
+
+/* unistd.h cannot be included, its write() clashes with the mila one */
+extern ssize_t read(int fd, void *buf, size_t count);
+
+static int isSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* keeps the unread bytes and appends the next block, 0 if nothing was added */
+static int refillInput(void) {
+    size_t Left = InputEnd - InputPos;
+    ssize_t n;
+
+    if (InputEOF)
+        return 0;
+    memmove(InputBuffer, InputBuffer + InputPos, Left);
+    InputPos = 0;
+    InputEnd = Left;
+
+    do
+        n = read(0, InputBuffer + InputEnd, INPUT_BUFFER_SIZE - InputEnd);
+    while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        InputEOF = 1;
+        n = 0;
+    }
+    InputEnd += (size_t) n;
+    memset(InputBuffer + InputEnd, 0, INPUT_PADDING);
+    return n > 0;
+}
+
+/* moves to the next token, 0 at the end of input */
+static int skipSpaces(void) {
+    for (;;) {
+        while (InputPos < InputEnd && isSpace(InputBuffer[InputPos]))
+            InputPos++;
+        if (InputPos < InputEnd)
+            return 1;
+        if (!refillInput())
+            return 0;
+    }
+}
+
+/* makes sure the token at InputPos is not cut by the end of the buffer */
+static void bufferToken(void) {
+    size_t i = InputPos;
+    for (;;) {
+        while (i < InputEnd && !isSpace(InputBuffer[i]))
+            i++;
+        if (i < InputEnd || InputEnd - InputPos == INPUT_BUFFER_SIZE)
+            return;
+        i -= InputPos;
+        if (!refillInput())
+            return;
+    }
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/* number of leading decimal digits among the eight characters in Chunk */
+static unsigned countDigits(uint64_t Chunk) {
+    uint64_t x = Chunk ^ 0x3030303030303030ULL;
+    uint64_t NonDigits = (((x & 0x7F7F7F7F7F7F7F7FULL) + 0x7676767676767676ULL) | x)
+                         & 0x8080808080808080ULL;
+    return NonDigits ? (unsigned) __builtin_ctzll(NonDigits) / 8 : 8;
+}
+
+/* value of eight digit characters, the first one most significant */
+static unsigned parseEightDigits(uint64_t Chunk) {
+    Chunk = ((Chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    Chunk = ((Chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return (unsigned) (((Chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+}
+#endif
+
+/* same results as scanf("%d"): 1 if read, 0 if no number, EOF at the end */
+static int readInt(int *x) {
+    const char *p, *Digits;
+    unsigned Value = 0;
+    int Negative;
+
+    if (!skipSpaces())
+        return EOF;
+    bufferToken();
+
+    p = InputBuffer + InputPos;
+    Negative = *p == '-';
+    if (*p == '-' || *p == '+')
+        p++;
+    Digits = p;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    {
+        uint64_t Chunk;
+        unsigned n;
+        memcpy(&Chunk, p, sizeof(Chunk));
+        n = countDigits(Chunk);
+        if (n) {
+            /* shifting in zero bytes from below adds leading zeros */
+            Value = parseEightDigits(Chunk << (8 * (8 - n)));
+            p += n;
+        }
+    }
+#endif
+    while ((unsigned) (*p - '0') < 10)
+        Value = Value * 10 + (unsigned) (*p++ - '0');
+
+    if (p == Digits)
+        return 0;
+    InputPos = (size_t) (p - InputBuffer);
+    *x = Negative ? (int) (0u - Value) : (int) Value;
+    return 1;
+}
 
 int writeln(int x) {
-    printf("%d\n", x);
+    putInt(x, 1);
     return 0;
 }
 int write(int x) {
-    printf("%d", x);
+    putInt(x, 0);
     return 0;
 }
 int readln(int *x) {
-    return scanf("%d", x);
+    /* a prompt written before must be visible while waiting for input */
+    flushOutput();
+    return readInt(x);
+}
+/* reads up to n numbers into a, returns how many were read */
+int readlnArray(int *a, int n) {
+    int i;
+    flushOutput();
+    for (i = 0; i < n; i++)
+        if (readInt(a + i) != 1)
+            break;
+    return i;
+}
+/* called by --bounds-check code, the program stops with an error */
+void milaBoundsError(int index, int lo, int hi) {
+    flushOutput();
+    fprintf(stderr, "error: index %d out of bounds [%d .. %d]\n", index, lo, hi);
+    exit(1);
+}
+#ifdef MILA_JIT_RUNTIME
+/* the compiler writes out what the program printed once its main returns */
+void milaJITFlush(void) {
+    flushOutput();
 }
+#endif
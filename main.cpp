@@ -1,4 +1,16 @@
 #include "Parser.hpp"
+#include "Options.hpp"
+#include "Optimizer.hpp"
+#include "Target.hpp"
+#include "JIT.hpp"
+#include "Link.hpp"
+#include "DebugInfo.hpp"
+#include "Remarks.hpp"
+#include "Cache.hpp"
+#include "Batch.hpp"
+#include "Server.hpp"
+#include "Diagnostics.hpp"
+#include "Incremental.hpp"
 
 #include <stdio.h>
 #include <algorithm>
@@ -14,26 +26,21 @@
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/IR/LegacyPassManager.h"
 
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Utils.h"
-
 //Use tutorials in: https://llvm.org/docs/tutorial/
 
-int main (int argc, char *argv[]) {
-    
-    // Install standard binary operators.
-    // 1 is lowest precedence.
+/// installBinopPrecedences - precedences of the built-in binary operators,
+/// 1 is the lowest
+static void installBinopPrecedences() {
     BinopPrecedence['='] = 2;
+    BinopPrecedence[tok_assign] = 2;
     
     BinopPrecedence['>']                = 10;
     BinopPrecedence[tok_greaterequal]   = 10;
@@ -41,102 +48,231 @@ int main (int argc, char *argv[]) {
     BinopPrecedence[tok_lessequal]      = 10;
     BinopPrecedence[tok_notequal]       = 10;
 
-    BinopPrecedence['+'] = 20;
-    BinopPrecedence['-'] = 20;
+    BinopPrecedence['+']     = 20;
+    BinopPrecedence['-']     = 20;
+    BinopPrecedence[tok_or]  = 20;
+    BinopPrecedence[tok_xor] = 20;
     
-    BinopPrecedence['*'] = 40;
-    BinopPrecedence['/'] = 40; // highest.
+    BinopPrecedence['*']     = 40;
+    BinopPrecedence['/']     = 40;
+    BinopPrecedence[tok_div] = 40;
+    BinopPrecedence[tok_mod] = 40;
+    BinopPrecedence[tok_and] = 40; // highest.
+}
+
+/// writeModuleIR - print M to Output for --emit-llvm
+static bool writeModuleIR(Module &M, StringRef Output) {
+    std::error_code EC;
+    raw_fd_ostream OS(Output, EC, sys::fs::OF_Text);
+    if (EC) {
+        diags() << "Could not open file: " << EC.message();
+        return false;
+    }
+    M.print(OS, nullptr);
+    finishRemarks();
+    return true;
+}
+
+/// emitProgram - compile TheModule into the object Output (-c) or into the
+/// executable Output
+static bool emitProgram(TargetMachine &TM, StringRef Output) {
+    // the object is only kept with -c, otherwise it goes to temporary files
+    // that are linked with the runtime archive into the executable; -j
+    // splits the module into one object per codegen thread
+    const UnitOptions &Opts = getUnitOptions();
+    unsigned Parts = getCodegenJobs();
+    std::vector<std::string> Objects;
+    std::vector<std::unique_ptr<FileRemover>> ObjectRemovers;
+    if (Opts.CompileOnly)
+        Objects.push_back(Output.str());
+    for (unsigned I = 0; I < Parts && !Opts.CompileOnly; ++I) {
+        SmallString<128> Filename;
+        if (auto EC = sys::fs::createTemporaryFile("mila", "o", Filename)) {
+            diags() << "Could not create temporary file: " << EC.message();
+            return false;
+        }
+        Objects.push_back(std::string(Filename));
+        ObjectRemovers.push_back(std::make_unique<FileRemover>(Filename));
+    }
+
+    std::string Error;
+    bool Emitted = Objects.size() == 1
+                       ? emitObjectFile(*TheModule, TM, Objects[0], Error)
+                       : emitSplitObjectFiles(*TheModule, Objects, Error);
+    if (!Emitted) {
+        diags() << Error;
+        return false;
+    }
+    finishRemarks();
+
+    if (!Opts.CompileOnly) {
+        // with --incremental every function has an object of its own
+        Objects.insert(Objects.end(), getFunctionObjects().begin(), getFunctionObjects().end());
+        std::string LinkError;
+        if (!linkExecutable(Objects, Output, LinkError)) {
+            diags() << "error: " << LinkError << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+/// compile - compile the source file Input into Output, returns the exit
+/// code of the compiler
+static int compile(StringRef Input, StringRef Output) {
+    installBinopPrecedences();
+
+    // source file from the command line, stdin if "-"
+    std::string SourceError;
+    auto Source = SourceBuffer::open(Input.str(), SourceError);
+    if (!Source) {
+        diags() << "error: " << SourceError << "\n";
+        return 1;
+    }
+    TheLexer = std::make_unique<Lexer>(*Source);
  
     getNextToken(); // eat program
     getNextToken(); // eat name
-    std::string programName = m_IdentifierStr;
+    std::string programName(CurTokInfo.Text);
     getNextToken(); // eat ;
 
-    InitializeModuleAndPassManager();
+    // the target machine exists before codegen, so that the passes run on
+    // each finished function already know the data layout and target costs
+    std::string Error;
+    std::unique_ptr<TargetMachine> TheTargetMachine(createHostTargetMachine(Error));
+    if (!TheTargetMachine) {
+        diags() << "error: " << Error << "\n";
+        return 1;
+    }
+
+    // an identical earlier compilation may have left the output already
+    std::string CacheKey;
+    if (cacheEnabled()) {
+        CacheKey = computeCacheKey(*Source, *TheTargetMachine);
+        if (fetchFromCache(CacheKey, Output)) {
+            reportCacheResult(true);
+            return 0;
+        }
+    }
+
+    InitializeModuleAndPassManager(TheTargetMachine.get());
+    initializeIncremental(*TheTargetMachine);
+
+    // remarks point at Mila lines through the debug locations of statements
+    if (!initializeRemarks(*TheContext, Error)) {
+        diags() << "error: " << Error << "\n";
+        return 1;
+    }
+    if (remarksEnabled())
+        initializeDebugInfo(Input);
+
     // create writeln and readln functions
     readlnFunction();
     writelnFunction();
 
     MainLoop();
 
-    InitializeAllTargetInfos();
-    InitializeAllTargets();
-    InitializeAllTargetMCs();
-    InitializeAllAsmParsers();
-    InitializeAllAsmPrinters();
-
-    // InitializeNativeTarget();
-    // InitializeNativeTargetAsmPrinter();
-    // InitializeNativeTargetAsmParser();
-    
+    // main is generated last, from all top-level statements at once
+    Function * mainFunction = getFunction(Sym_main);
+    if (!mainFunction || mainFunction->empty())
+        return 1; // its error has been reported
+    Builder->CreateRet(Builder->getInt32(0));
+    finalizeDebugInfo();
 
-    auto TargetTriple = sys::getDefaultTargetTriple();
-    TheModule->setTargetTriple(TargetTriple);
-    
-    std::string Error;
-    auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
+    if (shouldDumpIR(DumpAfterCodegen))
+        TheModule->print(diags(), nullptr);
 
-    // Print an error and exit if we couldn't find the requested target.
-    // This generally occurs if we've forgotten to initialise the
-    // TargetRegistry or we have a bogus target triple.
-    if (!Target) {
-        errs() << "errors: " << Error;
+    if (verifyFunction(*mainFunction, &diags()))
         return 1;
-    }
 
+    // every function has been generated, release the whole AST at once
+    FunctionProtos.clear();
+    AST.reset();
 
-    // generic cpu without any additional features, options or relocation model
-    auto CPU = "generic";
-    auto Features = "";
-
-    Function * mainFunction = getFunction("main");
-    Builder->CreateRet(Builder->getInt32(0));
-    verifyFunction(*mainFunction);
+    // optimize first, so that --dump-ir=after-opt sees what codegen gets
+    optimizeModule(*TheModule);
 
-    TargetOptions opt;
-    auto RM = Optional<Reloc::Model>();
-    auto TheTargetMachine =
-    Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
+    if (shouldDumpIR(DumpAfterOpt))
+        TheModule->print(diags(), nullptr);
 
-    TheModule->setDataLayout(TheTargetMachine->createDataLayout());
-
-    auto Filename = "output.o";
-    std::error_code EC;
-    raw_fd_ostream dest(Filename, EC, sys::fs::OF_None);
+    // --run executes the program in memory instead of writing output.o
+    if (RunProgram) {
+        finishRemarks();
+        return runModule(std::move(TheModule), std::move(TheContext), *TheTargetMachine);
+    }
 
-    if (EC) {
-        errs() << "Could not open file: " << EC.message();
+    // --emit-llvm stops at the optimized module
+    if (getUnitOptions().EmitLLVM ? !writeModuleIR(*TheModule, Output) : !emitProgram(*TheTargetMachine, Output))
         return 1;
+
+    if (!CacheKey.empty()) {
+        storeInCache(CacheKey, Output);
+        reportCacheResult(false);
+        if (incrementalEnabled())
+            reportIncrementalResult();
     }
+    return 0;
+}
 
-    legacy::PassManager pass;
-    auto FileType = CGFT_ObjectFile;
+/// compileUnit - compile, then drop what the compilation left behind; a
+/// --batch thread compiles its next unit on the same state
+static int compileUnit(StringRef Input, StringRef Output) {
+    int RC = compile(Input, Output);
+    TheLexer.reset();
+    resetCodegenState();
+    return RC;
+}
 
-    if (TheTargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType)) {
-        errs() << "TheTargetMachine can't emit a file of this type";
+int main (int argc, char *argv[]) {
+
+    cl::HideUnrelatedOptions(MilaCategory);
+    cl::ParseCommandLineOptions(argc, argv, "mila compiler\n");
+
+    if (OptLevel > 3) {
+        errs() << "error: invalid optimization level -O" << OptLevel << "\n";
         return 1;
     }
+    if (InputFilenames.size() > 1 && !Batch) {
+        errs() << "error: more than one input file, compile them with --batch\n";
+        return 1;
+    }
+    std::string Input = InputFilenames.empty() ? "-" : InputFilenames[0];
+
+    // the thin client leaves all the work, the initialization too, to the server
+    if (!ConnectSocket.empty())
+        return compileOnServer(ConnectSocket, Input, getOutputFilename());
 
+    // getCodegenJobs() keeps the backend on one thread there, say so
+    if (Jobs.getNumOccurrences() && Jobs != 1 && !Batch && (CompileOnly || remarksEnabled()))
+        errs() << "warning: -j" << Jobs << " is ignored with "
+               << (CompileOnly ? "-c" : "--remarks or --remarks-file")
+               << ", machine code is generated on one thread\n";
+
+    InitializeAllTargetInfos();
+    InitializeAllTargets();
+    InitializeAllTargetMCs();
+    InitializeAllAsmParsers();
+    InitializeAllAsmPrinters();
 
-        // Promote allocas to registers.
-    pass.add(createPromoteMemoryToRegisterPass());
-    // Do simple "peephole" optimizations and bit-twiddling optzns.
-    pass.add(createInstructionCombiningPass());
-    // Reassociate expressions.
-    pass.add(createReassociatePass());
-    // Reassociate expressions.
-    pass.add(createJumpThreadingPass());
-    pass.add(createCFGSimplificationPass());
-    TheModule->print(errs(), nullptr);
+    // InitializeNativeTarget();
+    // InitializeNativeTargetAsmPrinter();
+    // InitializeNativeTargetAsmParser();
 
-    pass.run(*TheModule);
-    dest.flush();
+    std::string Error;
+    if (!initializeCache(Error)) {
+        errs() << "error: " << Error << "\n";
+        return 1;
+    }
 
-    // outs() << "Wrote " << Filename << "\n";
+    // a long-lived server pays for the initialization above only once
+    if (!ServeSocket.empty())
+        return serve(ServeSocket, compileUnit);
 
-    system("clang  output.o fce.c -o output.out");
+    // targets and options are shared, every unit has a thread of its own
+    if (Batch)
+        return compileBatch(InputFilenames, compileUnit);
 
-    return 0;
+    return compileUnit(Input, getOutputFilename());
 
 /*
     Parser parser;
@@ -19,4 +19,63 @@ do
 
     cd ./../tests
 
-done
\ No newline at end of file
+done
+# loops have to reach LLVM in a form its vectorizer accepts
+echo -e "checking loop vectorization"
+cd ./../build
+for file in forSum.mila
+do
+    if ./mila -c -o /dev/null --dump-ir=after-opt < ./../tests/$file 2>&1 | grep -q "^vector.body:"; then
+        echo -e "$file: vectorized"
+    else
+        echo -e "$file: NOT vectorized"
+    fi
+done
+# tail calls must not grow the stack, even without optimization
+echo -e "checking tail calls"
+for file in tailCalls.mila
+do
+    if ./mila -O0 -o tailcalls.out < ./../tests/$file 2> /dev/null && ./tailcalls.out > /dev/null; then
+        echo -e "$file: constant stack"
+    else
+        echo -e "$file: FAILED at -O0"
+    fi
+done
+# the compile server must build and run what a local build does, and
+# survive a malformed request
+echo -e "checking the compile server"
+SERVE_DIR=$(mktemp -d)
+SOCKET=$SERVE_DIR/mila.sock
+./mila --serve=$SOCKET 2> $SERVE_DIR/serve.log < /dev/null &
+SERVE_PID=$!
+for i in $(seq 50); do
+    [ -S $SOCKET ] && break
+    sleep 0.1
+done
+for file in fibonacci.mila
+do
+    ./mila -o $SERVE_DIR/local.out ./../tests/$file 2> /dev/null
+    $SERVE_DIR/local.out > $SERVE_DIR/local.txt
+    ./mila --connect=$SOCKET -o $SERVE_DIR/served.out ./../tests/$file 2> /dev/null
+    $SERVE_DIR/served.out > $SERVE_DIR/served.txt
+    ./mila --connect=$SOCKET --run ./../tests/$file < /dev/null > $SERVE_DIR/run.txt 2> /dev/null
+    if cmp -s $SERVE_DIR/local.txt $SERVE_DIR/served.txt && cmp -s $SERVE_DIR/local.txt $SERVE_DIR/run.txt; then
+        echo -e "$file: same through --connect"
+    else
+        echo -e "$file: DIFFERENT through --connect"
+    fi
+done
+# a block size no server can hold, sent raw
+ANSWER=$(perl -MSocket -e '
+    socket(my $S, PF_UNIX, SOCK_STREAM, 0) or exit 1;
+    connect($S, pack_sockaddr_un($ARGV[0])) or exit 1;
+    syswrite($S, "object\nx.mila\n18446744073709551615\n");
+    local $/; print <$S>;' $SOCKET)
+if echo "$ANSWER" | grep -q "bad request" &&
+   ./mila --connect=$SOCKET -c -o $SERVE_DIR/after.o ./../tests/fibonacci.mila 2> /dev/null; then
+    echo -e "malformed request: rejected, server still serving"
+else
+    echo -e "malformed request: FAILED"
+fi
+kill $SERVE_PID
+rm -rf $SERVE_DIR